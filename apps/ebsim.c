@@ -0,0 +1,680 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+/*
+ * ebsim.c - A simulator of the EBNeuro BE Plus LTM device.
+ *
+ * Listens on the device ports and speaks enough of the protocol for
+ * the ebneuro driver: the init handshake, the preset upload, the mode
+ * switches and the impedance request. In the sampling and test modes
+ * synthetic data packets are streamed at the preset rate, optionally
+ * faster than real time, so the driver can be exercised and measured
+ * without the hardware.
+ */
+
+#include <unistd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "packets.h"
+
+/* Values in the table of one period of the synthetic signal. */
+#define SIM_WAVE_LEN 256
+
+/**
+ * struct sim - The simulated device.
+ * @addr:	Address to listen on.
+ * @speed:	Rate of the data relative to real time, zero for unpaced.
+ * @drop:	Leave out every drop-th data packet, zero to send all.
+ * @verbose:	Log the requests.
+ * @fd_listen:	Listening sockets of the init, control and data ports.
+ * @fd_ctrl:	Connected control socket.
+ * @fd_data:	Connected data socket.
+ * @mode:	Current device mode, EB_MODE_*.
+ * @packet_rate: Packets per second from the preset.
+ * @data_rate:	Records per second from the preset.
+ * @seq:	Counter of the next data packet.
+ * @next:	Time at which the next data packet is due.
+ * @pkt:	Buffer of a data packet.
+ * @pending:	Bytes of the data packet in @pkt left to send.
+ * @off:	Offset of the first byte left to send in @pkt.
+ * @wave:	One period of the synthetic signal.
+ * @sent:	Data packets sent since the sampling started.
+ * @start:	Time at which the sampling started.
+ */
+struct sim {
+	const char *addr;
+	double speed;
+	unsigned int drop;
+	bool verbose;
+
+	int fd_listen[3];
+	int fd_ctrl;
+	int fd_data;
+
+	int mode;
+	int packet_rate;
+	int data_rate;
+	uint32_t seq;
+	long long next;
+	uint8_t *pkt;
+	size_t pending;
+	size_t off;
+	int16_t wave[SIM_WAVE_LEN];
+
+	unsigned long long sent;
+	long long start;
+};
+
+static volatile sig_atomic_t stop;
+
+static void stop_sim(int signum)
+{
+	(void)signum;
+	stop = 1;
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * sim_listen() - Open a listening socket.
+ */
+static int sim_listen(const char *addr, int port)
+{
+	struct sockaddr_in sa = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+	};
+	int fd, one = 1;
+
+	if (inet_pton(AF_INET, addr, &sa.sin_addr) != 1)
+		return -EINVAL;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -errno;
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) || listen(fd, 1)) {
+		close(fd);
+		return -errno;
+	}
+
+	return fd;
+}
+
+/**
+ * sim_accept() - Wait for a client on a listening socket.
+ */
+static int sim_accept(int fd)
+{
+	int ret;
+
+	do {
+		ret = accept(fd, NULL, NULL);
+	} while (ret < 0 && errno == EINTR && !stop);
+
+	return ret < 0 ? -errno : ret;
+}
+
+static int sim_send_all(int fd, const void *buf, size_t len)
+{
+	const uint8_t *pos = buf;
+	ssize_t ret;
+
+	while (len) {
+		ret = send(fd, pos, len, MSG_NOSIGNAL);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+
+		pos += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static int sim_recv_all(int fd, void *buf, size_t len)
+{
+	uint8_t *pos = buf;
+	ssize_t ret;
+
+	while (len) {
+		ret = recv(fd, pos, len, 0);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+		if (!ret)
+			return -EPIPE;
+
+		pos += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+/**
+ * sim_recv_req() - Receive a request packet.
+ * @buf: Buffer for the payload.
+ * @len: Size of @buf, a longer payload is truncated.
+ *
+ * Return: The packet ID or negative errno.
+ */
+static int sim_recv_req(int fd, void *buf, size_t len)
+{
+	struct eb_packet_hdr hdr;
+	uint8_t payload[UINT16_MAX + 1];
+	size_t plen;
+	int ret;
+
+	ret = sim_recv_all(fd, &hdr, sizeof(hdr));
+	if (ret < 0)
+		return ret;
+
+	if (hdr.magic != EB_PACKET_START_MAGIC)
+		return -EBADMSG;
+
+	/* The payload is followed by the end magic. */
+	plen = be16_to_cpu(hdr.length);
+	ret = sim_recv_all(fd, payload, plen + 1);
+	if (ret < 0)
+		return ret;
+
+	if (payload[plen] != EB_PACKET_END_MAGIC)
+		return -EBADMSG;
+
+	memset(buf, 0, len);
+	memcpy(buf, payload, plen < len ? plen : len);
+
+	return hdr.id;
+}
+
+/**
+ * sim_reply() - Send a response with payload and error code.
+ */
+static int sim_reply(int fd, uint8_t id, const void *buf, uint16_t len, int err)
+{
+	uint8_t pkt[EB_PACKET_LEN(UINT16_MAX)];
+	struct eb_packet_hdr *hdr = (struct eb_packet_hdr *)pkt;
+	__le16 code = cpu_to_le16(err);
+
+	hdr->magic = EB_PACKET_START_MAGIC;
+	hdr->id = id;
+	hdr->length = cpu_to_be16(len + sizeof(code));
+	if (len)
+		memcpy(hdr->data, buf, len);
+	memcpy(&hdr->data[len], &code, sizeof(code));
+	hdr->data[len + sizeof(code)] = EB_PACKET_END_MAGIC;
+
+	return sim_send_all(fd, pkt, EB_PACKET_LEN(len + sizeof(code)));
+}
+
+/**
+ * sim_init() - Serve the init socket until the client closes it.
+ */
+static int sim_init(struct sim *sim, int fd)
+{
+	struct eb_client client = {
+		.status = cpu_to_le32(0),
+		.name = "ebsim",
+	};
+	struct eb_device device = {
+		.name = "BE Plus LTM simulator",
+	};
+	struct eb_firmware fw = {
+		.release = cpu_to_le16(1),
+	};
+	struct eb_hardware hw = {
+		.serial = cpu_to_le32(1),
+		.capabilities = cpu_to_le32(EB_CAP_EEG | EB_CAP_WIFI),
+	};
+	struct eb_sock_state state;
+	uint8_t buf[256];
+	int id, ret;
+
+	for (;;) {
+		id = sim_recv_req(fd, buf, sizeof(buf));
+		if (id == -EPIPE)
+			return 0;
+		if (id < 0)
+			return id;
+
+		if (sim->verbose)
+			fprintf(stderr, "init: request %d\n", id);
+
+		switch (id) {
+		case EB_IPK_ID_CLIENT:
+			ret = sim_reply(fd, id, &client, sizeof(client), 0);
+			break;
+		case EB_IPK_ID_DEVICE:
+			ret = sim_reply(fd, id, &device, sizeof(device), 0);
+			break;
+		case EB_IPK_ID_FIRMWARE:
+			ret = sim_reply(fd, id, &fw, sizeof(fw), 0);
+			break;
+		case EB_IPK_ID_HARDWARE:
+			ret = sim_reply(fd, id, &hw, sizeof(hw), 0);
+			break;
+		case EB_IPK_ID_SET_SOCK:
+			memcpy(&state, buf, sizeof(state));
+			if (sim->verbose)
+				fprintf(stderr, "init: socket %d state %d\n",
+					le16_to_cpu(state.index), le16_to_cpu(state.state));
+			ret = sim_reply(fd, id, NULL, 0, 0);
+			break;
+		case EB_IPK_ID_CLIENT_SET:
+			ret = sim_reply(fd, id, NULL, 0, 0);
+			break;
+		default:
+			fprintf(stderr, "init: unknown request %d\n", id);
+			ret = sim_reply(fd, id, NULL, 0, 1);
+		}
+
+		if (ret < 0)
+			return ret;
+	}
+}
+
+/**
+ * sim_set_mode() - Switch the device mode.
+ */
+static void sim_set_mode(struct sim *sim, int mode)
+{
+	double secs;
+
+	if (sim->mode == EB_MODE_SAMPLE || sim->mode == EB_MODE_WAVE) {
+		secs = (now_ns() - sim->start) / 1e9;
+		fprintf(stderr, "Sent %llu packets in %.3f s (%.1f packets/s).\n",
+			sim->sent, secs, secs > 0 ? sim->sent / secs : 0);
+	}
+
+	sim->mode = mode;
+
+	if (mode == EB_MODE_SAMPLE || mode == EB_MODE_WAVE) {
+		sim->sent = 0;
+		sim->start = now_ns();
+		sim->next = sim->start;
+	}
+}
+
+/**
+ * sim_set_preset() - Apply an uploaded preset.
+ *
+ * Return: Error code for the reply.
+ */
+static int sim_set_preset(struct sim *sim, const struct eb_preset *preset)
+{
+	int packet_rate = le16_to_cpu(preset->packet_rate);
+	int data_rate = le16_to_cpu(preset->eeg_rates[0]);
+	uint8_t *pkt;
+
+	if (packet_rate <= 0 || data_rate < packet_rate || EB_DATA_LEN(data_rate / packet_rate) > UINT16_MAX)
+		return 1;
+
+	pkt = realloc(sim->pkt, EB_PACKET_LEN(EB_DATA_LEN(data_rate / packet_rate)));
+	if (!pkt)
+		return 1;
+
+	sim->pkt = pkt;
+	sim->packet_rate = packet_rate;
+	sim->data_rate = data_rate;
+
+	fprintf(stderr, "Preset: %d packets/s, %d samples/s.\n", packet_rate, data_rate);
+
+	return 0;
+}
+
+/**
+ * sim_impedance() - Fill in the synthetic impedance values.
+ */
+static void sim_impedance(struct eb_impedance_info *info)
+{
+	int i;
+
+	for (i = 0; i < EB_BEPLUSLTM_EEG_CHAN; ++i) {
+		info->eeg[i].p = cpu_to_le16(5 + i % 10);
+		info->eeg[i].n = cpu_to_le16(5 + i % 10);
+	}
+
+	for (i = 0; i < EB_BEPLUSLTM_DC_CHAN; ++i) {
+		info->dc[i].p = cpu_to_le16((uint16_t)EB_IMP_NONE);
+		info->dc[i].n = cpu_to_le16((uint16_t)EB_IMP_NONE);
+	}
+
+	info->ref.p = info->ref.n = cpu_to_le16(3);
+	info->gnd.p = info->gnd.n = cpu_to_le16(3);
+}
+
+/**
+ * sim_ctrl() - Serve a single control request.
+ */
+static int sim_ctrl(struct sim *sim)
+{
+	struct eb_impedance_info imp = { 0 };
+	struct eb_preset preset;
+	struct eb_mode mode;
+	uint8_t buf[sizeof(struct eb_preset)];
+	int id;
+
+	id = sim_recv_req(sim->fd_ctrl, buf, sizeof(buf));
+	if (id < 0)
+		return id;
+
+	if (sim->verbose)
+		fprintf(stderr, "ctrl: request %d\n", id);
+
+	switch (id) {
+	case EB_CPK_ID_MODE_SET:
+		memcpy(&mode, buf, sizeof(mode));
+		sim_set_mode(sim, le16_to_cpu(mode.mode));
+		return sim_reply(sim->fd_ctrl, id, NULL, 0, 0);
+
+	case EB_CPK_ID_PRESET_UPL:
+		memcpy(&preset, buf, sizeof(preset));
+		return sim_reply(sim->fd_ctrl, id, NULL, 0, sim_set_preset(sim, &preset));
+
+	case EB_CPK_ID_IMPEDANCE:
+		sim_impedance(&imp);
+		return sim_reply(sim->fd_ctrl, id, &imp, sizeof(imp), 0);
+
+	default:
+		fprintf(stderr, "ctrl: unknown request %d\n", id);
+		return sim_reply(sim->fd_ctrl, id, NULL, 0, 1);
+	}
+}
+
+/**
+ * sim_make_data() - Generate the next data packet.
+ */
+static void sim_make_data(struct sim *sim)
+{
+	int cnt = sim->data_rate / sim->packet_rate;
+	struct eb_packet_hdr *hdr = (struct eb_packet_hdr *)sim->pkt;
+	size_t len = EB_DATA_LEN(cnt);
+	uint32_t seq = sim->seq++;
+	unsigned long long sample = (unsigned long long)seq * cnt;
+	__le32 seq_le = cpu_to_le32(seq);
+	__le16 *data = (__le16 *)&hdr->data[sizeof(seq_le)];
+	int i, j;
+
+	if (sim->drop && seq % sim->drop == sim->drop - 1)
+		return;
+
+	hdr->magic = EB_PACKET_START_MAGIC;
+	hdr->id = EB_DPK_ID_DATA;
+	hdr->length = cpu_to_be16(len);
+	memcpy(hdr->data, &seq_le, sizeof(seq_le));
+
+	/* Each channel is the same signal shifted in phase, the test mode is a square wave. */
+	for (i = 0; i < cnt; ++i) {
+		for (j = 0; j < EB_BEPLUSLTM_EEG_CHAN + EB_BEPLUSLTM_DC_CHAN; ++j) {
+			int16_t val = sim->wave[(sample + i + j * 4) % SIM_WAVE_LEN];
+
+			if (sim->mode == EB_MODE_WAVE)
+				val = val < 0 ? -1000 : 1000;
+
+			if (j < EB_BEPLUSLTM_EEG_CHAN)
+				data[i * EB_BEPLUSLTM_EEG_CHAN + j] = cpu_to_le16(val);
+			else
+				data[cnt * EB_BEPLUSLTM_EEG_CHAN + i * EB_BEPLUSLTM_DC_CHAN
+				     + j - EB_BEPLUSLTM_EEG_CHAN] = cpu_to_le16(val);
+		}
+
+		data[cnt * (EB_BEPLUSLTM_EEG_CHAN + EB_BEPLUSLTM_DC_CHAN) + i] = 0;
+	}
+
+	memset(&hdr->data[len - 2 * sizeof(__be16)], 0, 2 * sizeof(__be16));
+	hdr->data[len] = EB_PACKET_END_MAGIC;
+
+	sim->sent++;
+	sim->pending = EB_PACKET_LEN(len);
+	sim->off = 0;
+}
+
+/**
+ * sim_flush_data() - Send as much of the pending data packet as possible.
+ *
+ * The data socket is never waited on, so the control requests are
+ * served even if the client doesn't keep up with the data.
+ *
+ * Return: One if the packet was sent, zero if the socket is full or negative errno.
+ */
+static int sim_flush_data(struct sim *sim)
+{
+	ssize_t ret;
+
+	while (sim->pending) {
+		ret = send(sim->fd_data, &sim->pkt[sim->off], sim->pending,
+			   MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (ret < 0)
+			return -errno;
+
+		sim->off += ret;
+		sim->pending -= ret;
+	}
+
+	return 1;
+}
+
+/**
+ * sim_stream() - Serve the control and data sockets until the client leaves.
+ */
+static int sim_stream(struct sim *sim)
+{
+	struct pollfd pfd[2] = {
+		{ .fd = sim->fd_ctrl, .events = POLLIN },
+		{ .fd = sim->fd_data, .events = POLLOUT },
+	};
+	bool streaming;
+	long long now;
+	int ret, timeout;
+
+	sim->pending = 0;
+
+	while (!stop) {
+		streaming = (sim->mode == EB_MODE_SAMPLE || sim->mode == EB_MODE_WAVE)
+			    && sim->pkt;
+		timeout = -1;
+
+		if (sim->pending) {
+			/* Wait for the client to read, the packet is already late. */
+		} else if (streaming && !sim->speed) {
+			timeout = 0;
+		} else if (streaming) {
+			now = now_ns();
+			timeout = sim->next > now ? (sim->next - now + 999999) / 1000000 : 0;
+		}
+
+		ret = poll(pfd, sim->pending ? 2 : 1, timeout);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+
+		if (pfd[0].revents) {
+			ret = sim_ctrl(sim);
+			if (ret == -EPIPE)
+				return 0;
+			if (ret < 0)
+				return ret;
+			continue;
+		}
+
+		/* A partially sent packet is finished even after a mode switch. */
+		ret = sim_flush_data(sim);
+		if (ret <= 0) {
+			if (ret < 0)
+				return ret;
+			continue;
+		}
+
+		/* Catch up with all the packets that are due. */
+		now = now_ns();
+		while (streaming && (!sim->speed || sim->next <= now)) {
+			sim_make_data(sim);
+			sim->next += 1e9 / (sim->packet_rate * (sim->speed ? sim->speed : 1));
+
+			ret = sim_flush_data(sim);
+			if (ret <= 0) {
+				if (ret < 0)
+					return ret;
+				break;
+			}
+
+			/* Unpaced, but still look at the control socket once in a while. */
+			if (!sim->speed && sim->seq % sim->packet_rate == 0)
+				break;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * sim_serve() - Serve one client session.
+ */
+static int sim_serve(struct sim *sim)
+{
+	int fd, ret;
+
+	fd = sim_accept(sim->fd_listen[0]);
+	if (fd < 0)
+		return fd;
+
+	ret = sim_init(sim, fd);
+	close(fd);
+	if (ret < 0)
+		return ret;
+
+	/* The client closes the init socket when it's done, or after disabling the sockets. */
+	ret = poll(&(struct pollfd){ .fd = sim->fd_listen[1], .events = POLLIN }, 1, 1000);
+	if (ret <= 0)
+		return 0;
+
+	sim->fd_ctrl = sim_accept(sim->fd_listen[1]);
+	if (sim->fd_ctrl < 0)
+		return sim->fd_ctrl;
+
+	sim->fd_data = sim_accept(sim->fd_listen[2]);
+	if (sim->fd_data < 0) {
+		close(sim->fd_ctrl);
+		return sim->fd_data;
+	}
+
+	fprintf(stderr, "Client connected.\n");
+
+	ret = sim_stream(sim);
+
+	sim_set_mode(sim, EB_MODE_IDLE);
+	close(sim->fd_data);
+	close(sim->fd_ctrl);
+
+	fprintf(stderr, "Client disconnected.\n");
+
+	return ret;
+}
+
+void usage(char *pn)
+{
+	fprintf(stderr, "Usage: %s [-vh] [-a addr] [-x speed] [-g n]\n\n", pn);
+	fprintf(stderr, " -a addr   Address to listen on (default: 127.0.0.1).\n");
+	fprintf(stderr, " -x speed  Data rate relative to real time, 0 for as fast as possible.\n");
+	fprintf(stderr, " -g n      Leave out every n-th data packet.\n");
+	fprintf(stderr, " -v        Be more verbose.\n");
+	fprintf(stderr, " -h        Print this help message.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static const int ports[] = {
+		EB_SOCK_PORT_INIT, EB_SOCK_PORT_CTRL, EB_SOCK_PORT_DATA,
+	};
+	struct sim sim = {
+		.addr = "127.0.0.1",
+		.speed = 1,
+		.mode = EB_MODE_IDLE,
+	};
+	int i, ret, opt;
+
+	while ((opt = getopt(argc, argv, "a:x:g:vh")) != -1) {
+		switch (opt) {
+			case 'a':
+				sim.addr = optarg;
+				break;
+			case 'x':
+				sim.speed = atof(optarg);
+				break;
+			case 'g':
+				sim.drop = atoi(optarg);
+				break;
+			case 'v':
+				sim.verbose = true;
+				break;
+			case 'h':
+				usage(argv[0]);
+				exit(0);
+			default: /* '?' */
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (sim.speed < 0) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	signal(SIGINT, stop_sim);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < SIM_WAVE_LEN; ++i)
+		sim.wave[i] = 1000 * sin(2 * M_PI * i / SIM_WAVE_LEN);
+
+	for (i = 0; i < 3; ++i) {
+		sim.fd_listen[i] = sim_listen(sim.addr, ports[i]);
+		if (sim.fd_listen[i] < 0) {
+			fprintf(stderr, "Failed to listen on %s:%d: %d\n", sim.addr, ports[i], sim.fd_listen[i]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	fprintf(stderr, "Listening on %s:%d-%d.\n", sim.addr, ports[0], ports[2]);
+
+	while (!stop) {
+		ret = sim_serve(&sim);
+		if (ret < 0 && !stop)
+			fprintf(stderr, "Session failed: %d\n", ret);
+	}
+
+	for (i = 0; i < 3; ++i)
+		close(sim.fd_listen[i]);
+
+	free(sim.pkt);
+
+	return 0;
+}
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+/*
+ * engine.c - Acquire data from multiple devices with one engine.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <med/eeg.h>
+#include <med/engine.h>
+
+#define DEV_CNT 4
+
+int main(void)
+{
+	int i, j, ret, chan_cnt;
+	struct med_eeg *dev[DEV_CNT];
+	struct med_engine *eng;
+	struct med_kv conf[] = {{"channels", "8"}, {"rate", "250"}, {0}};
+	float *data;
+
+	ret = med_engine_create(&eng, 1);
+	assert(!ret);
+
+	for (i = 0; i < DEV_CNT; ++i) {
+		ret = med_eeg_create(&dev[i], "dummy", conf);
+		assert(!ret);
+
+		ret = med_eeg_set_mode(dev[i], MED_EEG_SAMPLING);
+		assert(!ret);
+
+		ret = med_engine_add(eng, dev[i]);
+		assert(!ret);
+	}
+
+	chan_cnt = med_eeg_get_channels(dev[0], NULL);
+	data = malloc(chan_cnt * 25 * sizeof(*data));
+
+	ret = med_engine_start(eng);
+	assert(!ret);
+
+	for (i = 0; i < 10; ++i) {
+		for (j = 0; j < DEV_CNT; ++j) {
+			ret = med_eeg_sample(dev[j], data, 25);
+			assert(ret == 25);
+
+			printf("%6.1f ", data[0]);
+		}
+		printf("\n");
+	}
+
+	med_engine_stop(eng);
+
+	for (i = 0; i < DEV_CNT; ++i) {
+		ret = med_eeg_set_mode(dev[i], MED_EEG_IDLE);
+		assert(!ret);
+
+		med_eeg_destroy(dev[i]);
+	}
+
+	med_engine_destroy(eng);
+	free(data);
+
+	return 0;
+}
@@ -2,6 +2,8 @@
 #ifndef LIBMED_EEG_H
 #define LIBMED_EEG_H
 
+#include <stdint.h>
+
 /**
  * enum med_eeg_mode - Modes of operation for an EEG device.
  *
@@ -17,6 +19,65 @@ enum med_eeg_mode {
 	MED_EEG_TEST,
 };
 
+/**
+ * enum med_eeg_overflow - What to do when the sample queue is full.
+ *
+ * @MED_EEG_DROP_OLDEST: Drop the oldest queued sample.
+ * @MED_EEG_DROP_NEWEST: Drop the newly received sample.
+ * @MED_EEG_BLOCK:       Stop receiving until the user reads the samples.
+ *                       Only possible if the samples are read from a
+ *                       different thread and the device is not run by
+ *                       an engine, otherwise same as MED_EEG_DROP_NEWEST.
+ */
+enum med_eeg_overflow {
+	MED_EEG_DROP_OLDEST,
+	MED_EEG_DROP_NEWEST,
+	MED_EEG_BLOCK,
+};
+
+/**
+ * struct med_eeg_stats - Sample queue statistics.
+ * @received: Total amount of samples added to the queue.
+ * @dropped:  Total amount of samples lost due to the queue overflow.
+ * @lost:     Total amount of samples the device sent that never arrived,
+ *            as seen from the gaps in the device packet counter. The
+ *            samples the device resends later are no longer counted.
+ * @queued:   Amount of samples currently in the queue.
+ * @capacity: Maximum amount of samples the queue can hold.
+ */
+struct med_eeg_stats {
+	unsigned long long received;
+	unsigned long long dropped;
+	unsigned long long lost;
+	unsigned int queued;
+	unsigned int capacity;
+};
+
+/**
+ * struct med_eeg_sample_info - Per-sample metadata.
+ * @seq:       Monotonic sequence number of the sample. Derived from
+ *             the device packet counter where available, so a jump
+ *             by more than one means that the samples were lost.
+ * @timestamp: Host CLOCK_MONOTONIC time in nanoseconds at which the
+ *             sample was received.
+ */
+struct med_eeg_sample_info {
+	unsigned long long seq;
+	long long timestamp;
+};
+
+/**
+ * struct med_eeg_scale - Conversion of the ADC codes to physical units.
+ * @gain:   Multiplier of the code.
+ * @offset: Value added after the multiplication.
+ *
+ * The value of a channel is (code * @gain + @offset).
+ */
+struct med_eeg_scale {
+	float gain;
+	float offset;
+};
+
 /**
  * struct med_kv - Key-Value configuration pair.
  */
@@ -43,6 +104,18 @@ struct med_eeg;
  * is populated with a pointer to the new EEG device object
  * to be used with other methods.
  *
+ * Besides the driver-specific keys, following keys are handled
+ * for all the devices:
+ *	verbosity     - Debug output level.
+ *	queue_samples - Capacity of the sample queue. (Default: 4096)
+ *	queue_policy  - Overflow policy of the sample queue:
+ *	                drop-oldest (default), drop-newest or block.
+ *	raw           - Queue the ADC codes instead of the values
+ *	                in physical units if set to 1. (Default: 0)
+ *	select        - Comma separated labels of the channels to
+ *	                acquire, in the order they shall appear in
+ *	                the samples. (Default: all channels)
+ *
  * Return: Zero on success and negative error otherwise.
  */
 int med_eeg_create(struct med_eeg **dev, char *type, struct med_kv *kv);
@@ -50,6 +123,10 @@ int med_eeg_create(struct med_eeg **dev, char *type, struct med_kv *kv);
 /**
  * med_eeg_destroy() - Unprepare the deivce and free the used resources.
  * @dev:  The device to destroy.
+ *
+ * A device registered with an engine must be removed from it, or the
+ * engine stopped and destroyed, first. The engine workers still use
+ * the device otherwise.
  */
 void med_eeg_destroy(struct med_eeg *dev);
 
@@ -71,6 +148,8 @@ int med_eeg_set_mode(struct med_eeg *dev, enum med_eeg_mode mode);
  * @labels: Pointer to write a label array to.
  *
  * This method returns driver-specific labels for the data.
+ * If only some channels were selected at creation, only those
+ * are returned.
  *
  * Return: Amount of channel labels or a negative error number.
  */
@@ -92,10 +171,233 @@ int med_eeg_get_channels(struct med_eeg *dev, char ***labels);
  * @count is zero. In this case the data will be queued
  * but no samples will be written out.
  *
+ * If the acquisition thread is running (see med_eeg_start()),
+ * this method doesn't touch the device and only waits for the
+ * thread to queue enough samples.
+ *
  * Returns: Amount of values read or a negative error.
  */
 int med_eeg_sample(struct med_eeg *dev, float *samples, int count);
 
+/**
+ * med_eeg_sample_ts() - Read samples blocking, with metadata.
+ * @dev:     The device to read from.
+ * @samples: Pointer to the buffer to fill with the data.
+ * @info:    Pointer to the buffer to fill with the metadata.
+ * @count:   Amount of samples to read.
+ *
+ * Same as med_eeg_sample(), but also writes the sequence number and
+ * the receive timestamp of every sample into @info. The @info buffer
+ * size must fit
+ *	(sizeof(struct med_eeg_sample_info) * count)
+ *
+ * Returns: Amount of values read or a negative error.
+ */
+int med_eeg_sample_ts(struct med_eeg *dev, float *samples,
+		      struct med_eeg_sample_info *info, int count);
+
+/**
+ * med_eeg_sample_planar() - Read samples blocking, grouped by channel.
+ * @dev:     The device to read from.
+ * @samples: Pointer to the buffer to fill with the data.
+ * @count:   Amount of samples to read.
+ *
+ * Same as med_eeg_sample(), but the buffer is filled with
+ * channel_count contiguous arrays of @count values, i.e.
+ * value of channel c in sample i is at (@samples[c * @count + i]).
+ *
+ * Returns: Amount of values read or a negative error.
+ */
+int med_eeg_sample_planar(struct med_eeg *dev, float *samples, int count);
+
+/**
+ * med_eeg_sample_raw() - Read the ADC codes blocking.
+ * @dev:     The device to read from.
+ * @samples: Pointer to the buffer to fill with the codes.
+ * @count:   Amount of samples to read.
+ *
+ * Same as med_eeg_sample(), but the codes are copied out exactly
+ * as they were received, see med_eeg_get_scales() for conversion.
+ * Only available on devices created with the "raw" key set, the
+ * samples passed to the callback or returned by med_eeg_peek()
+ * are then int32_t codes too.
+ *
+ * Returns: Amount of values read or a negative error.
+ */
+int med_eeg_sample_raw(struct med_eeg *dev, int32_t *samples, int count);
+
+/**
+ * med_eeg_get_scales() - Read the conversion of the ADC codes.
+ * @dev:    The device to act on.
+ * @scales: Pointer to the buffer to fill, must fit
+ *	(sizeof(struct med_eeg_scale) * dev->channel_count)
+ *
+ * Returns: Amount of channels or a negative error.
+ */
+int med_eeg_get_scales(struct med_eeg *dev, struct med_eeg_scale *scales);
+
+/**
+ * med_eeg_sample_timeout() - Read the available samples with a timeout.
+ * @dev:     The device to read from.
+ * @samples: Pointer to the buffer to fill with the data.
+ * @count:   Maximum amount of samples to read.
+ * @timeout: Time to wait for the data in milliseconds, negative to wait forever.
+ *
+ * Unlike med_eeg_sample(), this method doesn't wait for the whole
+ * @count. It waits up to @timeout for the first samples to arrive
+ * and then returns whatever is available. Only the data that the
+ * device has already sent is received, a partially received packet
+ * is completed by a later call.
+ *
+ * Returns: Amount of samples read (possibly zero) or a negative error.
+ */
+int med_eeg_sample_timeout(struct med_eeg *dev, float *samples, int count, int timeout);
+
+/**
+ * med_eeg_sample_nb() - Read the available samples without waiting.
+ * @dev:     The device to read from.
+ * @samples: Pointer to the buffer to fill with the data.
+ * @count:   Maximum amount of samples to read.
+ *
+ * Same as med_eeg_sample_timeout() with zero timeout.
+ *
+ * Returns: Amount of samples read (possibly zero) or a negative error.
+ */
+int med_eeg_sample_nb(struct med_eeg *dev, float *samples, int count);
+
+/**
+ * med_eeg_get_fd() - Get a file descriptor to wait for the data on.
+ * @dev: The device to act on.
+ *
+ * The returned descriptor becomes readable when new samples can be
+ * read with med_eeg_sample_nb(), so it can be added to an event loop
+ * (e.g. poll or epoll). The samples already received are not signalled
+ * again, so once it's readable, call med_eeg_sample_nb() until it
+ * returns less than the requested count before waiting again.
+ *
+ * It's the underlying device descriptor, or an event descriptor if the
+ * acquisition thread is running. The user must not read from or close
+ * it. The descriptor changes when the acquisition is started or stopped.
+ *
+ * Returns: File descriptor or a negative error if the driver has none.
+ */
+int med_eeg_get_fd(struct med_eeg *dev);
+
+/**
+ * med_eeg_start() - Start the background acquisition thread.
+ * @dev: The device to sample.
+ *
+ * This method starts a thread that continuously receives the
+ * data from the device into the internal queue, so the device
+ * is serviced even if the user doesn't call med_eeg_sample()
+ * often enough. The device should be put into the desired mode
+ * before starting the acquisition, med_eeg_set_mode() and
+ * med_eeg_get_impedance() fail with -EBUSY while it's running.
+ *
+ * Returns: Zero on success or a negative error.
+ */
+int med_eeg_start(struct med_eeg *dev);
+
+/**
+ * med_eeg_stop() - Stop the background acquisition thread.
+ * @dev: The device to act on.
+ *
+ * The samples that were already queued stay available. The thread
+ * is woken up even if it's waiting for a silent device.
+ *
+ * Returns: Zero or the error that has stopped the thread.
+ */
+int med_eeg_stop(struct med_eeg *dev);
+
+/**
+ * med_eeg_set_callback() - Deliver the samples to a callback.
+ * @dev:       The device to act on.
+ * @fn:        The function to call or NULL to remove the callback.
+ * @user:      Opaque pointer to pass to @fn.
+ * @min_batch: Minimal amount of samples to deliver at once.
+ *
+ * Once at least @min_batch samples are queued, @fn is invoked with
+ * a pointer to the queued samples in place, laid out the same way
+ * as med_eeg_sample() writes them. The samples are released when
+ * @fn returns. Since the queue may wrap around, a single batch may
+ * be delivered in two calls.
+ *
+ * The callback is invoked right after the data is received, i.e.
+ * from the acquisition thread if it's running (see med_eeg_start())
+ * or from med_eeg_sample() otherwise. With the callback installed
+ * med_eeg_sample() can only be used with zero @count to receive
+ * the data.
+ *
+ * Returns: Zero on success or a negative error.
+ */
+int med_eeg_set_callback(struct med_eeg *dev,
+		void (*fn)(struct med_eeg *dev, const float *samples, int count, void *user),
+		void *user, int min_batch);
+
+/**
+ * med_eeg_set_queue() - Configure the sample queue.
+ * @dev:      The device to act on.
+ * @capacity: New capacity of the queue in samples, or zero to keep it.
+ * @policy:   What to do when the queue is full.
+ *
+ * Changing the capacity discards the queued samples. The queue can't
+ * be reconfigured while the acquisition is running, nor made smaller
+ * than the min_batch of the callback, see med_eeg_set_callback().
+ *
+ * Returns: Zero on success or a negative error.
+ */
+int med_eeg_set_queue(struct med_eeg *dev, int capacity, enum med_eeg_overflow policy);
+
+/**
+ * med_eeg_get_stats() - Read the sample queue statistics.
+ * @dev:   The device to act on.
+ * @stats: Pointer to the structure to fill.
+ *
+ * The counters can be read at any time, e.g. to monitor the
+ * amount of dropped samples while the acquisition is running.
+ *
+ * Returns: Zero on success or a negative error.
+ */
+int med_eeg_get_stats(struct med_eeg *dev, struct med_eeg_stats *stats);
+
+/**
+ * med_eeg_peek() - Look at the queued samples without copying them.
+ * @dev:        The device to look at.
+ * @data:       Pointer to return the oldest queued sample to.
+ * @count:      Pointer to return the amount of samples at @data to.
+ * @wrap:       Pointer to return the rest of the samples to. Can be NULL.
+ * @wrap_count: Pointer to return the amount of samples at @wrap to.
+ *
+ * This method exposes the internal sample storage in place. The
+ * samples are laid out the same way as med_eeg_sample() writes them,
+ * however the queue may wrap around, so the samples are returned
+ * as two spans with @wrap following @data. If @wrap is NULL, only
+ * the first span is returned.
+ *
+ * The pointers stay valid until the samples are released with
+ * med_eeg_consume() or another call that reads the device. This
+ * method doesn't receive new data, use med_eeg_sample() with a
+ * zero @count to queue the pending samples first.
+ *
+ * While the acquisition is running, the oldest samples would be
+ * overwritten under the caller with the MED_EEG_DROP_OLDEST policy,
+ * so the queue must be set up to drop the newest samples or block
+ * (see med_eeg_set_queue()), otherwise -EBUSY is returned.
+ *
+ * Returns: Amount of samples available in both spans or a negative error.
+ */
+int med_eeg_peek(struct med_eeg *dev, const float **data, int *count,
+		 const float **wrap, int *wrap_count);
+
+/**
+ * med_eeg_consume() - Release samples returned by med_eeg_peek().
+ * @dev:   The device to act on.
+ * @count: Amount of the oldest samples to release.
+ *
+ * Returns: Amount of samples released or a negative error.
+ */
+int med_eeg_consume(struct med_eeg *dev, int count);
+
 /**
  * med_get_impedance() - Read impedances.
  * @dev: The device to read from.
@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+#ifndef LIBMED_ENGINE_H
+#define LIBMED_ENGINE_H
+
+#include <med/eeg.h>
+
+/**
+ * struct med_engine - Acquisition engine for multiple devices.
+ *
+ * The engine waits for the data on all registered devices at once
+ * and services them from a small pool of worker threads, so the
+ * amount of threads doesn't depend on the amount of devices. Each
+ * device keeps its own sample queue that is read as usual with
+ * med_eeg_sample() and friends, which only consume the samples
+ * while the engine is running, same as with med_eeg_start().
+ */
+struct med_engine;
+
+/**
+ * med_engine_create() - Construct an acquisition engine.
+ * @eng:     Pointer to return the engine instance to.
+ * @threads: Amount of worker threads, zero or negative to use
+ *           one thread per online CPU.
+ *
+ * Return: Zero on success and negative error otherwise.
+ */
+int med_engine_create(struct med_engine **eng, int threads);
+
+/**
+ * med_engine_destroy() - Stop the engine and free the used resources.
+ * @eng:  The engine to destroy.
+ *
+ * The registered devices are not destroyed.
+ */
+void med_engine_destroy(struct med_engine *eng);
+
+/**
+ * med_engine_add() - Register a device with the engine.
+ * @eng:  The engine to act on.
+ * @dev:  The device to add.
+ *
+ * The device must support med_eeg_get_fd() and should be already
+ * put into the desired mode. Devices can be added only while the
+ * engine is stopped.
+ *
+ * Return: Zero on success and negative error otherwise.
+ */
+int med_engine_add(struct med_engine *eng, struct med_eeg *dev);
+
+/**
+ * med_engine_remove() - Unregister a device from the engine.
+ * @eng:  The engine to act on.
+ * @dev:  The device to remove.
+ *
+ * Devices can be removed only while the engine is stopped.
+ *
+ * Return: Zero on success and negative error otherwise.
+ */
+int med_engine_remove(struct med_engine *eng, struct med_eeg *dev);
+
+/**
+ * med_engine_start() - Start acquiring the data from all the devices.
+ * @eng:  The engine to start.
+ *
+ * If a device fails, it's released by the engine and the error is
+ * reported by the next med_eeg_sample() on that device. The other
+ * devices are not affected.
+ *
+ * Return: Zero on success and negative error otherwise.
+ */
+int med_engine_start(struct med_engine *eng);
+
+/**
+ * med_engine_stop() - Stop the acquisition.
+ * @eng:  The engine to stop.
+ *
+ * Waits for the workers to finish, only then the devices can be used
+ * on their own again. The samples that were already queued stay
+ * available.
+ */
+void med_engine_stop(struct med_engine *eng);
+
+#endif /* LIBMED_ENGINE_H */
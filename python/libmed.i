@@ -104,6 +104,45 @@
 	$result = val_arr$argnum;
 }
 
+/*
+ * Output eeg samples grouped by channel.
+ */
+%typemap(in, numinputs=1, fragment="NumPy_Fragments")
+  (float *planar, int count)
+  (PyObject* val_arr = NULL)
+{
+	if (!PyLong_Check($input)) {
+		PyErr_Format(PyExc_TypeError, "Expected number but '%s' given.",
+				pytype_string($input));
+		SWIG_fail;
+	}
+
+	$2 = PyLong_AsLong($input);
+	if ($2 == -1 && PyErr_Occurred())
+                SWIG_fail;
+
+	struct med_eeg *dev;
+	int res = SWIG_ConvertPtr($self, (void**)&dev, $descriptor(struct med_eeg*), 0);
+	if (!SWIG_IsOK(res)) {
+		SWIG_exception_fail(SWIG_ArgError(res), "in method '" "$symname" "', argument "
+				"$argnum"" of type '" "$type""'");
+	}
+
+	int slen = med_eeg_get_channels(dev, NULL);
+
+	/* The library writes the rows in place, no transpose on the Python side. */
+	val_arr = PyArray_SimpleNew(2, ((npy_intp []){slen, $2}), NPY_FLOAT);
+	if (!val_arr)
+		SWIG_fail;
+
+	$1 = (float*) array_data(val_arr);
+}
+%typemap(argout)
+  (float *planar, int count)
+{
+	$result = val_arr$argnum;
+}
+
 /*
  * Output eeg impedances.
  */
@@ -165,7 +204,10 @@
 	int set_mode(enum med_eeg_mode mode);
 	int get_channels(char ***labels=NULL);
 	int sample(float *samples=NULL, int count=0);
+	int sample_planar(float *planar=NULL, int count=0);
 	int get_impedance(float *samples);
+	int start();
+	int stop();
 }
 
 %extend med_eeg {
@@ -11,31 +11,96 @@
 #include <math.h>
 
 #include <med/eeg_priv.h>
+#include <system/system.h>
+#include <system/helpers.h>
 
 #define CHAN_CNT 4
 
-static int dummy_sample(struct med_eeg *dev)
+/* The values are generated as microvolt codes. */
+#define DUMMY_GAIN 0.000001f
+
+/**
+ * struct dummy_dev - Dummy device.
+ * @timer: Timer that paces the samples or -1 if unpaced.
+ * @due:   Timer expirations not turned into samples yet.
+ * @seq:   Sequence number of the next sample.
+ */
+struct dummy_dev {
+	struct med_eeg edev;
+
+	int timer;
+	unsigned long long due;
+	unsigned long long seq;
+};
+
+static void dummy_generate(struct dummy_dev *ddev)
 {
-	struct med_sample *next = med_eeg_alloc_sample(dev);
+	struct med_eeg *dev = &ddev->edev;
+	float *next = med_eeg_alloc_sample(dev);
 	static float v=1;
 	int i;
 
 	for (i = 0; i < dev->channel_count; ++i)
-		next->data[i] = 1. + sin(v+=0.1);
+		med_eeg_put_code(dev, next, i, (1. + sin(v+=0.1)) / DUMMY_GAIN);
+
+	med_eeg_add_sample(dev, ddev->seq++);
+}
+
+static int dummy_sample_batch(struct med_eeg *edev, int max)
+{
+	struct dummy_dev *dev = container_of(edev, struct dummy_dev, edev);
+	int i, ret, cnt = max;
+
+	/*
+	 * The timer is only waited for once the samples that are due
+	 * have been produced, at most max of them at a time.
+	 */
+	if (dev->timer >= 0) {
+		if (!dev->due) {
+			ret = s_timer_wait(dev->timer);
+			if (ret < 0)
+				return ret;
+			dev->due = ret;
+		}
+
+		if ((unsigned long long)cnt > dev->due)
+			cnt = dev->due;
+		dev->due -= cnt;
+	}
+
+	for (i = 0; i < cnt; ++i)
+		dummy_generate(dev);
+
+	return cnt;
+}
+
+static int dummy_sample(struct med_eeg *edev)
+{
+	return dummy_sample_batch(edev, 1);
+}
+
+static int dummy_get_fd(struct med_eeg *edev)
+{
+	struct dummy_dev *dev = container_of(edev, struct dummy_dev, edev);
+
+	return dev->timer;
+}
 
-	med_eeg_add_sample(dev, next);
+static bool dummy_pending(struct med_eeg *edev)
+{
+	struct dummy_dev *dev = container_of(edev, struct dummy_dev, edev);
 
-	return 1;
+	return dev->due;
 }
 
 static int dummy_get_impedance(struct med_eeg *dev, float *samples)
 {
 	int i;
 
-	for (i = 0; i < dev->channel_count; ++i)
+	for (i = 0; i < dev->source_count; ++i)
 		samples[i] = (float)i;
 
-	return dev->channel_count;
+	return dev->source_count;
 }
 
 static int dummy_set_mode(struct med_eeg *dev, enum med_eeg_mode mode)
@@ -45,46 +110,78 @@ static int dummy_set_mode(struct med_eeg *dev, enum med_eeg_mode mode)
 	return 0;
 }
 
-static void dummy_destroy(struct med_eeg *dev)
+static void dummy_destroy(struct med_eeg *edev)
 {
+	struct dummy_dev *dev = container_of(edev, struct dummy_dev, edev);
 	int i;
 
-	for (i = 0; i < dev->channel_count; ++i)
-		free(dev->channel_labels[i]);
+	if (dev->timer >= 0)
+		s_close(dev->timer);
 
-	free(dev->channel_labels);
+	for (i = 0; i < edev->channel_count; ++i)
+		free(edev->channel_labels[i]);
+
+	free(edev->channel_labels);
+	free(edev->scales);
 	free(dev);
 }
 
-int dummy_create(struct med_eeg **dev, struct med_kv *kv)
+int dummy_create(struct med_eeg **edev, struct med_kv *kv)
 {
-	int i, chan_cnt = CHAN_CNT;
+	struct dummy_dev *dev = malloc(sizeof(*dev));
+	int i, ret, rate = 0, chan_cnt = CHAN_CNT;
 	const char *key, *val;
 
-	(*dev) = malloc(sizeof(**dev));
-	memset(*dev, 0, sizeof(**dev));
+	memset(dev, 0, sizeof(*dev));
+
+	(*edev) = &dev->edev;
+	(*edev)->type          = "dummy";
 
-	(*dev)->type          = "dummy";
+	dev->timer = -1;
 
 	med_for_each_kv(kv, key, val) {
-		med_dbg(*dev, "Parsing %s=%s", key, val);
+		med_dbg(*edev, "Parsing %s=%s", key, val);
 
 		if (!strcmp("channels", key))
 			chan_cnt = atoi(val);
+		else if (!strcmp("rate", key))
+			rate = atoi(val);
 	}
 
-	(*dev)->channel_count  = chan_cnt;
-	(*dev)->channel_labels = malloc(sizeof(char**) * chan_cnt);
+	if (rate > 0) {
+		ret = s_timer(&dev->timer, 1000000 / rate);
+		if (ret < 0) {
+			med_err(*edev, "Failed to create the timer: %d", ret);
+			free(dev);
+			return ret;
+		}
+	}
+
+	(*edev)->channel_count  = chan_cnt;
+	(*edev)->channel_labels = malloc(sizeof(char**) * chan_cnt);
+
+	for (i = 0; i < chan_cnt; ++i) {
+		(*edev)->channel_labels[i] = malloc(sizeof(char) * 8);
+		snprintf((*edev)->channel_labels[i], 8, "sin%d", i);
+	}
+
+	(*edev)->scales = malloc(sizeof(*(*edev)->scales) * chan_cnt);
 
 	for (i = 0; i < chan_cnt; ++i) {
-		(*dev)->channel_labels[i] = malloc(sizeof(char) * 8);
-		snprintf((*dev)->channel_labels[i], 8, "sin%d", i);
+		(*edev)->scales[i].gain = DUMMY_GAIN;
+		(*edev)->scales[i].offset = 0;
 	}
 
-	(*dev)->sample         = dummy_sample;
-	(*dev)->get_impedance  = dummy_get_impedance;
-	(*dev)->set_mode       = dummy_set_mode;
-	(*dev)->destroy        = dummy_destroy;
+	(*edev)->sample         = dummy_sample;
+	(*edev)->sample_batch   = dummy_sample_batch;
+	(*edev)->get_impedance  = dummy_get_impedance;
+	(*edev)->set_mode       = dummy_set_mode;
+	(*edev)->destroy        = dummy_destroy;
+
+	if (dev->timer >= 0) {
+		(*edev)->get_fd = dummy_get_fd;
+		(*edev)->pending = dummy_pending;
+	}
 	
 	return 0;
 }
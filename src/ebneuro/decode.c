@@ -0,0 +1,155 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+/*
+ * decode.c - Conversion of the BE Plus LTM 16-bit samples.
+ *
+ * The device sends each channel as a signed 16-bit little-endian value,
+ * the channels of a record are contiguous. The records are converted with
+ * SIMD kernels where the CPU supports them and a scalar fallback
+ * otherwise. All the paths give exactly the same results.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "ebneuro.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define EB_DECODE_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * eb_le16() - Read a single unaligned value.
+ */
+static inline int32_t eb_le16(const uint8_t *src)
+{
+	__le16 code;
+
+	memcpy(&code, src, sizeof(code));
+
+	return (int16_t)le16_to_cpu(code);
+}
+
+static void eb_decode_scalar(const uint8_t *src, int cnt, const float *gain,
+			     const float *offset, float *dst)
+{
+	int i;
+
+	for (i = 0; i < cnt; ++i)
+		dst[i] = eb_le16(&src[i * sizeof(__le16)]) * gain[i] + offset[i];
+}
+
+static void eb_decode_codes_scalar(const uint8_t *src, int cnt, float *dst)
+{
+	int32_t code;
+	int i;
+
+	for (i = 0; i < cnt; ++i) {
+		code = eb_le16(&src[i * sizeof(__le16)]);
+		memcpy(&dst[i], &code, sizeof(code));
+	}
+}
+
+#ifdef EB_DECODE_X86
+
+__attribute__((target("sse4.1")))
+static void eb_decode_sse41(const uint8_t *src, int cnt, const float *gain,
+			    const float *offset, float *dst)
+{
+	__m128 v;
+	int i;
+
+	for (i = 0; i + 4 <= cnt; i += 4) {
+		v = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)&src[i * 2])));
+		v = _mm_mul_ps(v, _mm_loadu_ps(&gain[i]));
+		_mm_storeu_ps(&dst[i], _mm_add_ps(v, _mm_loadu_ps(&offset[i])));
+	}
+
+	eb_decode_scalar(&src[i * 2], cnt - i, &gain[i], &offset[i], &dst[i]);
+}
+
+__attribute__((target("sse4.1")))
+static void eb_decode_codes_sse41(const uint8_t *src, int cnt, float *dst)
+{
+	int i;
+
+	for (i = 0; i + 4 <= cnt; i += 4)
+		_mm_storeu_si128((__m128i *)&dst[i],
+				 _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)&src[i * 2])));
+
+	eb_decode_codes_scalar(&src[i * 2], cnt - i, &dst[i]);
+}
+
+__attribute__((target("avx2")))
+static void eb_decode_avx2(const uint8_t *src, int cnt, const float *gain,
+			   const float *offset, float *dst)
+{
+	__m256 v;
+	int i;
+
+	for (i = 0; i + 8 <= cnt; i += 8) {
+		v = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&src[i * 2])));
+		v = _mm256_mul_ps(v, _mm256_loadu_ps(&gain[i]));
+		_mm256_storeu_ps(&dst[i], _mm256_add_ps(v, _mm256_loadu_ps(&offset[i])));
+	}
+
+	/* AVX2 implies SSE4.1, the DC block is only four channels. */
+	eb_decode_sse41(&src[i * 2], cnt - i, &gain[i], &offset[i], &dst[i]);
+}
+
+__attribute__((target("avx2")))
+static void eb_decode_codes_avx2(const uint8_t *src, int cnt, float *dst)
+{
+	int i;
+
+	for (i = 0; i + 8 <= cnt; i += 8)
+		_mm256_storeu_si256((__m256i *)&dst[i],
+				    _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&src[i * 2])));
+
+	eb_decode_codes_sse41(&src[i * 2], cnt - i, &dst[i]);
+}
+
+#endif /* EB_DECODE_X86 */
+
+/**
+ * eb_decode() - Convert the channel values of a record.
+ * @src:    The first value in the packet, needs not be aligned.
+ * @cnt:    Amount of channels.
+ * @gain:   Gain of each channel.
+ * @offset: Offset of each channel.
+ * @dst:    Output buffer for @cnt values.
+ *
+ * Same as med_eeg_put_code() for each channel.
+ */
+void eb_decode(const uint8_t *src, int cnt, const float *gain, const float *offset, float *dst)
+{
+#ifdef EB_DECODE_X86
+	if (__builtin_cpu_supports("avx2"))
+		eb_decode_avx2(src, cnt, gain, offset, dst);
+	else if (__builtin_cpu_supports("sse4.1"))
+		eb_decode_sse41(src, cnt, gain, offset, dst);
+	else
+#endif
+		eb_decode_scalar(src, cnt, gain, offset, dst);
+}
+
+/**
+ * eb_decode_codes() - Store the channel codes of a record in the raw mode.
+ * @src: The first value in the packet, needs not be aligned.
+ * @cnt: Amount of channels.
+ * @dst: Output frame cells for @cnt codes.
+ *
+ * Same as med_eeg_put_code() in the raw mode for each channel.
+ */
+void eb_decode_codes(const uint8_t *src, int cnt, float *dst)
+{
+#ifdef EB_DECODE_X86
+	if (__builtin_cpu_supports("avx2"))
+		eb_decode_codes_avx2(src, cnt, dst);
+	else if (__builtin_cpu_supports("sse4.1"))
+		eb_decode_codes_sse41(src, cnt, dst);
+	else
+#endif
+		eb_decode_codes_scalar(src, cnt, dst);
+}
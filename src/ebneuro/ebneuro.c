@@ -5,8 +5,11 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include <system/endiannes.h>
 #include <system/helpers.h>
@@ -53,6 +56,7 @@ static int eb_set_mode(struct eb_dev *dev, int mode)
 		return err;
 	}
 	eb_dbg("Flushed %d pending bytes.", err);
+	eb_rx_reset(dev);
 
 	msg.mode = cpu_to_le16(mode);
 	return eb_send_recv_err(dev->fd_ctrl, EB_CPK_ID_MODE_SET,
@@ -171,6 +175,8 @@ static int eb_prepare(struct eb_dev *dev)
 static int eb_set_preset(struct eb_dev *dev, int packet_rate, int data_rate)
 {
 	int i, err;
+	size_t rx_size = EB_RX_PACKETS * EB_PACKET_LEN(EB_DATA_LEN(data_rate / packet_rate));
+	uint8_t *rx;
 	struct eb_preset data = {
 		.name = "default",
 		.flags = cpu_to_le16(EB_FLAG_OHM_SIGNAL | EB_FLAG_STIM_MONITOR),
@@ -191,73 +197,244 @@ static int eb_set_preset(struct eb_dev *dev, int packet_rate, int data_rate)
 		return err;
 	}
 
+	/* The receive buffer is reused by all the data packets. */
+	rx = realloc(dev->rx, rx_size);
+	if (!rx)
+		return -ENOMEM;
+
+	dev->rx = rx;
+	dev->rx_size = rx_size;
+	eb_rx_reset(dev);
 	dev->data_rate = data_rate;
 	dev->packet_rate = packet_rate;
+	dev->sample_cnt = data_rate / packet_rate;
 
 	return 0;
 }
 
-static int ebneuro_sample(struct med_eeg *edev)
+/**
+ * eb_decode_record() - Decode a record of all the channels into a frame.
+ */
+static void eb_decode_record(struct eb_dev *dev, const uint8_t *data, int i, float *frame)
 {
-	struct eb_dev *dev = container_of(edev, struct eb_dev, edev);
-	int sample_cnt = (dev->data_rate / dev->packet_rate);
-	struct med_sample *next;
-	int i, j, ret = 0;
-	uint32_t seq;
-	/*
-	 * Packet format:
-	 *	le32 seq;
-	 *	le16 eeg[EEG_CHAN][cnt];
-	 *	le16 dc[DC_CHAN][cnt];
-	 *	le16 svc[1][cnt];
-	 *	be16 pulse_rate;
-	 *	be16 pulse_duration;
-	 */
-	int buflen = sizeof(__le32) 
-		+ sample_cnt * (EB_BEPLUSLTM_EEG_CHAN + EB_BEPLUSLTM_DC_CHAN + 1) * sizeof(__le16)
-		+ 2 * sizeof(__le16);
-
-	__le16 *data, *buffer = malloc(buflen);
-
-	/*
-	 * XXX HACK: eb_recv expects the device to append the __le16
-	 * error code to the message so we shall decrease the length
-	 * by that value. This means that the "pulse_duration" value
-	 * will be read into the error code.
-	 * We ignore it here for now anyway.
-	 */
-	ret = eb_recv(dev->fd_data, buffer, buflen - sizeof(__be16), NULL);
-	if (ret < 0) {
-		eb_err("Data recieval failure: %d", ret);
-		goto error;
+	const uint8_t *eeg = &data[i * EB_BEPLUSLTM_EEG_CHAN * sizeof(__le16)];
+	const uint8_t *dc = &data[(dev->sample_cnt * EB_BEPLUSLTM_EEG_CHAN
+				   + i * EB_BEPLUSLTM_DC_CHAN) * sizeof(__le16)];
+
+	if (dev->edev.raw) {
+		eb_decode_codes(eeg, EB_BEPLUSLTM_EEG_CHAN, frame);
+		eb_decode_codes(dc, EB_BEPLUSLTM_DC_CHAN, &frame[EB_BEPLUSLTM_EEG_CHAN]);
+	} else {
+		eb_decode(eeg, EB_BEPLUSLTM_EEG_CHAN, dev->gain, dev->offset, frame);
+		eb_decode(dc, EB_BEPLUSLTM_DC_CHAN, &dev->gain[EB_BEPLUSLTM_EEG_CHAN],
+			  &dev->offset[EB_BEPLUSLTM_EEG_CHAN], &frame[EB_BEPLUSLTM_EEG_CHAN]);
 	}
+}
+
+/**
+ * eb_queue_samples() - Decode a data packet into the sample ring.
+ *
+ * The packet is decoded right from the receive buffer, see EB_DATA_LEN()
+ * for the layout. The trailing pulse fields are ignored for now.
+ *
+ * Return: Amount of samples queued.
+ */
+static int eb_queue_samples(struct eb_dev *dev, const struct eb_packet_hdr *pkt, uint32_t seq)
+{
+	struct med_eeg *edev = &dev->edev;
+	int sample_cnt = dev->sample_cnt;
+	const uint8_t *data = &pkt->data[sizeof(__le32)];
+	float *next;
+	int i, j, chan, idx;
+	__le16 code;
 
-	seq = le32_to_cpu(*(__le32*)(buffer));
-	data = buffer + 2;
-	
 	for (i = 0; i < sample_cnt; ++i) {
 		next = med_eeg_alloc_sample(edev);
 
-		for (j = 0; j < EB_BEPLUSLTM_EEG_CHAN; ++j)
-			next->data[j] = 0.125f * 0.000001f * le16_to_cpu(
-					data[i*(EB_BEPLUSLTM_EEG_CHAN) + j]
-					);
+		/* With all the channels in the device order the whole blocks are converted. */
+		if (!edev->channel_map) {
+			eb_decode_record(dev, data, i, next);
+			med_eeg_add_sample(edev, (dev->seq_base + seq) * sample_cnt + i);
+			continue;
+		}
 
-		// TODO: the device has multiple modes.
-		for (j = 0; j < EB_BEPLUSLTM_DC_CHAN; ++j)
-			next->data[EB_BEPLUSLTM_EEG_CHAN+j] = 15.25f * le16_to_cpu(
-					data[sample_cnt*EB_BEPLUSLTM_EEG_CHAN
-						+ i*(EB_BEPLUSLTM_DC_CHAN) + j]
-					);
+		for (j = 0; j < edev->channel_count; ++j) {
+			chan = med_eeg_chan(edev, j);
 
-		med_eeg_add_sample(edev, next);
-	} 
+			if (chan < EB_BEPLUSLTM_EEG_CHAN)
+				idx = i*(EB_BEPLUSLTM_EEG_CHAN) + chan;
+			else
+				idx = sample_cnt*EB_BEPLUSLTM_EEG_CHAN
+					+ i*(EB_BEPLUSLTM_DC_CHAN) + chan - EB_BEPLUSLTM_EEG_CHAN;
 
-	ret = sample_cnt;
+			memcpy(&code, &data[idx * sizeof(code)], sizeof(code));
+			med_eeg_put_code(edev, next, j, (int16_t)le16_to_cpu(code));
+		}
 
-error:
-	free(buffer);
-	return ret;
+		med_eeg_add_sample(edev, (dev->seq_base + seq) * sample_cnt + i);
+	}
+
+	return sample_cnt;
+}
+
+/**
+ * eb_packet_seq() - Get the packet counter of a data or archive packet.
+ */
+static uint32_t eb_packet_seq(const struct eb_packet_hdr *pkt)
+{
+	__le32 seq;
+
+	/* The packets are not aligned in the buffer. */
+	memcpy(&seq, pkt->data, sizeof(seq));
+
+	return le32_to_cpu(seq);
+}
+
+/**
+ * eb_check_seq() - Track the packet counter of the live data.
+ *
+ * A jump forward means that the packets in between were lost, their
+ * range is remembered so the archive packets can fill it in. A packet
+ * slightly behind is a duplicate, one further back than EB_SEQ_WINDOW
+ * means that the device counter started over, the tracking follows it
+ * and the missing range can no longer be filled in.
+ *
+ * Return: False if the packet is older than the ones already queued.
+ */
+static bool eb_check_seq(struct eb_dev *dev, uint32_t seq)
+{
+	int32_t gap = seq - dev->next_seq;
+
+	if (dev->have_seq && gap < 0 && gap >= -EB_SEQ_WINDOW) {
+		eb_dbg("Skipping stale packet %u", seq);
+		return false;
+	}
+
+	if (dev->have_seq && gap < 0) {
+		eb_info("Packet counter went back from %u to %u, resyncing",
+			dev->next_seq - 1, seq);
+		dev->seq_base += dev->next_seq - seq;
+		dev->gap_pending = false;
+		gap = 0;
+	}
+
+	if (dev->have_seq && gap > 0) {
+		eb_info("Lost packets %u to %u", dev->next_seq, seq - 1);
+		med_eeg_lost(&dev->edev, (unsigned long long)gap * dev->sample_cnt);
+
+		if (!dev->gap_pending) {
+			dev->gap_first = dev->next_seq;
+			dev->gap_end = seq;
+			dev->gap_pending = true;
+		}
+	}
+
+	dev->have_seq = true;
+	dev->next_seq = seq + 1;
+
+	return true;
+}
+
+/**
+ * eb_handle_packet() - Process a packet from the data socket.
+ *
+ * Return: Amount of samples queued.
+ */
+static int eb_handle_packet(struct eb_dev *dev, const struct eb_packet_hdr *pkt)
+{
+	uint32_t seq;
+
+	switch (pkt->id) {
+	case EB_DPK_ID_DATA:
+	case EB_DPK_ID_ARCHIVE:
+		if (be16_to_cpu(pkt->length) != EB_DATA_LEN(dev->sample_cnt))
+			break;
+
+		seq = eb_packet_seq(pkt);
+
+		if (pkt->id == EB_DPK_ID_DATA)
+			return eb_check_seq(dev, seq) ? eb_queue_samples(dev, pkt, seq) : 0;
+
+		/* Only the archive packets in the missing range, and in order. */
+		if (!dev->gap_pending || (int32_t)(seq - dev->gap_first) < 0
+		    || (int32_t)(seq - dev->gap_end) >= 0)
+			break;
+
+		dev->gap_first = seq + 1;
+		dev->gap_pending = dev->gap_first != dev->gap_end;
+
+		med_eeg_recovered(&dev->edev, dev->sample_cnt);
+
+		return eb_queue_samples(dev, pkt, seq);
+
+	case EB_DPK_ID_ENDARCHIVE:
+		if (dev->gap_pending)
+			eb_info("Archive ended, packets %u to %u stay lost",
+				dev->gap_first, dev->gap_end - 1);
+		dev->gap_pending = false;
+		return 0;
+	}
+
+	eb_dbg("Skipping packet id=%d len=%d", pkt->id, be16_to_cpu(pkt->length));
+
+	return 0;
+}
+
+static int ebneuro_sample_batch(struct med_eeg *edev, int max)
+{
+	struct eb_dev *dev = container_of(edev, struct eb_dev, edev);
+	struct eb_packet_hdr *pkt;
+	int ret, cnt = 0;
+	bool filled = false;
+
+	while (cnt < max) {
+		if (eb_rx_packet(dev, &pkt)) {
+			cnt += eb_handle_packet(dev, pkt);
+			continue;
+		}
+
+		/*
+		 * Only wait once, then take what has arrived. A partial
+		 * packet is left for the next call, so the driver never
+		 * blocks once the caller has seen the fd readable.
+		 */
+		if (cnt || filled) {
+			ret = s_poll(dev->fd_data, 0);
+			if (ret < 0)
+				return ret;
+			if (!ret)
+				break;
+		}
+
+		ret = eb_rx_fill(dev);
+		if (ret < 0) {
+			eb_err("Data recieval failure: %d", ret);
+			return ret;
+		}
+
+		filled = true;
+	}
+
+	return cnt;
+}
+
+static int ebneuro_sample(struct med_eeg *edev)
+{
+	return ebneuro_sample_batch(edev, 1);
+}
+
+static int ebneuro_get_fd(struct med_eeg *edev)
+{
+	struct eb_dev *dev = container_of(edev, struct eb_dev, edev);
+
+	return dev->fd_data;
+}
+
+static bool ebneuro_pending(struct med_eeg *edev)
+{
+	struct eb_dev *dev = container_of(edev, struct eb_dev, edev);
+
+	return eb_rx_pending(dev);
 }
 
 static int ebneuro_get_impedance(struct med_eeg *edev, float *samples)
@@ -266,7 +443,7 @@ static int ebneuro_get_impedance(struct med_eeg *edev, float *samples)
 	struct eb_impedance_info data;
 	int err, i;
 
-	err = eb_request_info(dev->fd_init, EB_CPK_ID_IMPEDANCE,
+	err = eb_request_info(dev->fd_ctrl, EB_CPK_ID_IMPEDANCE,
 			      &data, sizeof(data));
 	if (err) {
 		eb_err("Impedance info request failed: %d", err);
@@ -282,6 +459,7 @@ static int ebneuro_get_impedance(struct med_eeg *edev, float *samples)
 		return err;
 	}
 	eb_dbg("Flushed %d pending bytes.", err);
+	eb_rx_reset(dev);
 
 	for (i = 0; i < EB_BEPLUSLTM_EEG_CHAN; ++i)
 		samples[i] = (int16_t)le16_to_cpu(data.eeg[i].p)
@@ -319,6 +497,8 @@ static void ebneuro_free_dev(struct med_eeg *edev)
 		free(edev->channel_labels[i]);
 
 	free(edev->channel_labels);
+	free(edev->scales);
+	free(dev->rx);
 	free(dev);
 }
 
@@ -393,9 +573,26 @@ int ebneuro_create(struct med_eeg **edev, struct med_kv *kv)
 		snprintf((*edev)->channel_labels[EB_BEPLUSLTM_EEG_CHAN + i], 8, "dc%d", i);
 	}
 
+	(*edev)->scales = calloc(chan_cnt, sizeof(*(*edev)->scales));
+
+	for (i = 0; i < EB_BEPLUSLTM_EEG_CHAN; ++i)
+		(*edev)->scales[i].gain = 0.125f * 0.000001f;
+
+	// TODO: the device has multiple modes.
+	for (i = 0; i < EB_BEPLUSLTM_DC_CHAN; ++i)
+		(*edev)->scales[EB_BEPLUSLTM_EEG_CHAN + i].gain = 15.25f;
+
+	for (i = 0; i < chan_cnt; ++i) {
+		dev->gain[i] = (*edev)->scales[i].gain;
+		dev->offset[i] = (*edev)->scales[i].offset;
+	}
+
 	(*edev)->sample         = ebneuro_sample;
+	(*edev)->sample_batch   = ebneuro_sample_batch;
 	(*edev)->get_impedance  = ebneuro_get_impedance;
 	(*edev)->set_mode       = ebneuro_set_mode;
+	(*edev)->get_fd         = ebneuro_get_fd;
+	(*edev)->pending        = ebneuro_pending;
 	(*edev)->destroy        = ebneuro_destroy;
 
 	ret = eb_prepare(dev);
@@ -3,6 +3,7 @@
 #define EBNEURO_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include <system/system.h>
 #include <system/endiannes.h>
@@ -12,11 +13,37 @@
 
 #include "packets.h"
 
+/* Data packets the receive buffer holds. */
+#define EB_RX_PACKETS 16
+
+/*
+ * Live packets this far behind the expected one are duplicates, a
+ * counter further back means the device started counting over.
+ */
+#define EB_SEQ_WINDOW 64
+
+#define EB_BEPLUSLTM_CHAN (EB_BEPLUSLTM_EEG_CHAN + EB_BEPLUSLTM_DC_CHAN)
+
 /**
  * struct eb_dev - ebneuro device.
  * @ipaddr:		IP of the device.
  * @packet_rate:	Desired amount of packets per second
  * @data_rate:		Desired amount of samples per second.
+ * @sample_cnt:		Amount of records in a data packet.
+ * @rx:			Receive buffer of the data socket.
+ * @rx_size:		Size of @rx.
+ * @rx_pos:		Start of the unparsed data in @rx.
+ * @rx_len:		End of the received data in @rx.
+ * @rx_skipped:		Garbage skipped while looking for a packet.
+ * @next_seq:		Expected counter of the next live data packet.
+ * @have_seq:		Whether @next_seq is known.
+ * @seq_base:		Added to the packet counter, keeps the sample sequence
+ *			going when the device counter starts over.
+ * @gap_first:		First packet of the range missing from the live data.
+ * @gap_end:		Packet right after the missing range.
+ * @gap_pending:	Whether the archive packets of the range are accepted.
+ * @gain:		Gain of each channel, for the vectorized decode.
+ * @offset:		Offset of each channel, for the vectorized decode.
  */
 struct eb_dev {
 
@@ -35,6 +62,23 @@ struct eb_dev {
 
 	int packet_rate;
 	int data_rate;
+	int sample_cnt;
+
+	uint8_t *rx;
+	size_t rx_size;
+	size_t rx_pos;
+	size_t rx_len;
+	unsigned int rx_skipped;
+
+	uint32_t next_seq;
+	bool have_seq;
+	unsigned long long seq_base;
+	uint32_t gap_first;
+	uint32_t gap_end;
+	bool gap_pending;
+
+	float gain[EB_BEPLUSLTM_CHAN];
+	float offset[EB_BEPLUSLTM_CHAN];
 };
 
 /* network.c */
@@ -44,6 +88,14 @@ int eb_recv(int fd, void *buf, uint16_t len, int *err);
 int eb_recv_err(int fd);
 int eb_send_recv_err(int fd, uint8_t pid, const void *buf, uint16_t len);
 int eb_request_info(int fd, uint8_t pid, void *buf, uint16_t len);
+int eb_rx_packet(struct eb_dev *dev, struct eb_packet_hdr **pkt);
+bool eb_rx_pending(struct eb_dev *dev);
+int eb_rx_fill(struct eb_dev *dev);
+void eb_rx_reset(struct eb_dev *dev);
+
+/* decode.c */
+void eb_decode(const uint8_t *src, int cnt, const float *gain, const float *offset, float *dst);
+void eb_decode_codes(const uint8_t *src, int cnt, float *dst);
 
 /* debug print helpers */
 #define eb_err(fmt, ...) \
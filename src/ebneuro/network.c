@@ -6,6 +6,8 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <stddef.h>
 
 #include <system/system.h>
 #include <system/endiannes.h>
@@ -148,3 +150,140 @@ int eb_request_info(int fd, uint8_t pid, void *buf, uint16_t len)
 	return err;
 }
 
+/**
+ * eb_rx_find() - Find the next complete packet in the data receive buffer.
+ * @dev:	The device.
+ *
+ * A packet is recognized by the start magic, a length that fits the
+ * buffer and the end magic right after the payload. Anything else is
+ * skipped.
+ *
+ * Return: The packet, left in the buffer, or NULL if more data is needed.
+ */
+static struct eb_packet_hdr *eb_rx_find(struct eb_dev *dev)
+{
+	uint8_t *start, *end = &dev->rx[dev->rx_len];
+	uint8_t *pos = &dev->rx[dev->rx_pos];
+	struct eb_packet_hdr *hdr;
+	size_t len;
+
+	while (end - pos >= (ptrdiff_t)sizeof(*hdr)) {
+		start = pos;
+		pos = memchr(pos, EB_PACKET_START_MAGIC, end - pos);
+		if (!pos) {
+			dev->rx_skipped += end - start;
+			pos = end;
+			break;
+		}
+
+		dev->rx_skipped += pos - start;
+
+		if (end - pos < (ptrdiff_t)sizeof(*hdr))
+			break;
+
+		hdr = (struct eb_packet_hdr *)pos;
+		len = EB_PACKET_LEN(be16_to_cpu(hdr->length));
+		if (len > dev->rx_size) {
+			dev->rx_skipped++;
+			pos++;
+			continue;
+		}
+
+		if ((size_t)(end - pos) < len)
+			break;
+
+		if (pos[len - 1] != EB_PACKET_END_MAGIC) {
+			dev->rx_skipped++;
+			pos++;
+			continue;
+		}
+
+		dev->rx_pos = pos - dev->rx;
+
+		return hdr;
+	}
+
+	dev->rx_pos = pos - dev->rx;
+
+	return NULL;
+}
+
+/**
+ * eb_rx_packet() - Take the next complete packet out of the data receive buffer.
+ * @dev:	The device.
+ * @pkt:	Pointer to return the packet in the buffer to.
+ *
+ * The packet stays valid until the next eb_rx_fill().
+ *
+ * Return: One if @pkt was set, zero if more data is needed.
+ */
+int eb_rx_packet(struct eb_dev *dev, struct eb_packet_hdr **pkt)
+{
+	struct eb_packet_hdr *hdr;
+
+	hdr = eb_rx_find(dev);
+	if (!hdr)
+		return 0;
+
+	*pkt = hdr;
+	dev->rx_pos += EB_PACKET_LEN(be16_to_cpu(hdr->length));
+
+	if (dev->rx_skipped) {
+		eb_info("Realigned after skipping %u bytes.", dev->rx_skipped);
+		dev->rx_skipped = 0;
+	}
+
+	return 1;
+}
+
+/**
+ * eb_rx_pending() - Check for a complete packet in the data receive buffer.
+ * @dev:	The device.
+ */
+bool eb_rx_pending(struct eb_dev *dev)
+{
+	return eb_rx_find(dev);
+}
+
+/**
+ * eb_rx_fill() - Receive whatever the device has sent into the data buffer.
+ *
+ * Blocks until at least one byte is available. Under load a single
+ * call may bring in several packets.
+ *
+ * Return: Amount of bytes received or negative errno.
+ */
+int eb_rx_fill(struct eb_dev *dev)
+{
+	size_t left = dev->rx_len - dev->rx_pos;
+	int ret;
+
+	/* Only an incomplete packet is left, move it to the front. */
+	memmove(dev->rx, &dev->rx[dev->rx_pos], left);
+	dev->rx_pos = 0;
+	dev->rx_len = left;
+
+	ret = s_read_some(dev->fd_data, &dev->rx[left], dev->rx_size - left);
+	if (ret < 0)
+		return ret;
+	if (!ret)
+		return -EPIPE;
+
+	dev->rx_len += ret;
+
+	return ret;
+}
+
+/**
+ * eb_rx_reset() - Drop everything in the data receive buffer.
+ *
+ * The stream starts over, so does the packet counter tracking.
+ */
+void eb_rx_reset(struct eb_dev *dev)
+{
+	dev->rx_pos = 0;
+	dev->rx_len = 0;
+	dev->rx_skipped = 0;
+	dev->have_seq = false;
+	dev->gap_pending = false;
+}
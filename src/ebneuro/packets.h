@@ -50,6 +50,22 @@ struct eb_packet_hdr {
 	uint8_t data[];
 };
 
+/*
+ * Data packet payload:
+ *	le32 seq;
+ *	le16 eeg[cnt][EEG_CHAN];
+ *	le16 dc[cnt][DC_CHAN];
+ *	le16 svc[cnt];
+ *	be16 pulse_rate;
+ *	be16 pulse_duration;
+ */
+#define EB_DATA_LEN(cnt) (sizeof(__le32) \
+	+ (cnt) * (EB_BEPLUSLTM_EEG_CHAN + EB_BEPLUSLTM_DC_CHAN + 1) * sizeof(__le16) \
+	+ 2 * sizeof(__be16))
+
+/* Whole packet on the wire: header, payload and the end magic. */
+#define EB_PACKET_LEN(len) (sizeof(struct eb_packet_hdr) + (len) + sizeof(uint8_t))
+
 #define EB_SOCK_ENABLED		0
 #define EB_SOCK_DISABLED	1
 #define EB_SOCK_CONNECTED	4
@@ -7,43 +7,201 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 
 #include <system/system.h>
 #include <med/eeg_priv.h>
 
 #include "drivers.h"
 
+/**
+ * med_eeg_parse_overflow() - Parse the overflow policy name.
+ */
+static int med_eeg_parse_overflow(const char *val)
+{
+	if (!strcmp(val, "drop-oldest"))
+		return MED_EEG_DROP_OLDEST;
+	if (!strcmp(val, "drop-newest"))
+		return MED_EEG_DROP_NEWEST;
+	if (!strcmp(val, "block"))
+		return MED_EEG_BLOCK;
+
+	return -EINVAL;
+}
+
+/**
+ * med_eeg_select() - Reduce the device channels to the given subset.
+ * @list: Comma separated channel labels.
+ */
+static int med_eeg_select(struct med_eeg *dev, const char *list)
+{
+	char **labels, *names, *name, *save;
+	struct med_eeg_scale *scales = NULL;
+	int i, j, ret = -EINVAL, cnt = 0;
+	int *map;
+
+	names = strdup(list);
+	map = malloc(sizeof(*map) * dev->channel_count);
+	labels = malloc(sizeof(*labels) * dev->channel_count);
+	if (dev->scales)
+		scales = malloc(sizeof(*scales) * dev->channel_count);
+	if (!names || !map || !labels || (dev->scales && !scales)) {
+		ret = -ENOMEM;
+		goto error;
+	}
+
+	for (name = strtok_r(names, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < dev->channel_count; ++i)
+			if (!strcmp(name, dev->channel_labels[i]))
+				break;
+
+		if (i == dev->channel_count) {
+			med_err(dev, "Unknown channel %s", name);
+			goto error;
+		}
+
+		for (j = 0; j < cnt; ++j) {
+			if (map[j] == i) {
+				med_err(dev, "Channel %s selected twice", name);
+				goto error;
+			}
+		}
+
+		map[cnt++] = i;
+	}
+
+	if (!cnt)
+		goto error;
+
+	for (j = 0; j < cnt; ++j) {
+		labels[j] = dev->channel_labels[map[j]];
+		dev->channel_labels[map[j]] = NULL;
+		if (scales)
+			scales[j] = dev->scales[map[j]];
+	}
+
+	for (i = 0; i < dev->channel_count; ++i)
+		free(dev->channel_labels[i]);
+
+	free(dev->channel_labels);
+	free(dev->scales);
+	free(names);
+
+	dev->channel_labels = labels;
+	dev->scales = scales;
+	dev->channel_map = map;
+	dev->channel_count = cnt;
+
+	return 0;
+
+error:
+	free(names);
+	free(map);
+	free(labels);
+	free(scales);
+	return ret;
+}
+
 int med_eeg_create(struct med_eeg **dev, char *type, struct med_kv *kv)
 {
+	int ret, frames = MED_RING_DEFAULT_FRAMES, overflow = MED_EEG_DROP_OLDEST;
 	struct med_kv *ckv = kv;
+	const char *select = NULL;
+	bool raw = false;
 	const char *key, *val;
 
 	med_for_each_kv(ckv, key, val) {
-		if (!strcmp(key, "verbosity"))
+		if (!strcmp(key, "verbosity")) {
 			s_set_verbosity(atoi(val));
+		} else if (!strcmp(key, "queue_samples")) {
+			frames = atoi(val);
+			if (frames < 1)
+				return -EINVAL;
+		} else if (!strcmp(key, "queue_policy")) {
+			overflow = med_eeg_parse_overflow(val);
+			if (overflow < 0)
+				return overflow;
+		} else if (!strcmp(key, "raw")) {
+			raw = atoi(val);
+		} else if (!strcmp(key, "select")) {
+			select = val;
+		}
 	}
 
 	if (!strcmp(type, "dummy"))
-		return dummy_create(dev, kv);
-	if (!strcmp(type, "ebneuro"))
-		return ebneuro_create(dev, kv);
-	if (!strcmp(type, "openbci"))
-		return openbci_create(dev, kv);
+		ret = dummy_create(dev, kv);
+	else if (!strcmp(type, "ebneuro"))
+		ret = ebneuro_create(dev, kv);
+	else if (!strcmp(type, "openbci"))
+		ret = openbci_create(dev, kv);
+	else
+		return -1;
 
-	return -1;
+	if (ret)
+		return ret;
+
+	(*dev)->event = -1;
+	(*dev)->space_event = -1;
+	(*dev)->stop_event = -1;
+	(*dev)->overflow = overflow;
+	(*dev)->raw = raw;
+	(*dev)->source_count = (*dev)->channel_count;
+
+	if (select) {
+		ret = med_eeg_select(*dev, select);
+		if (ret) {
+			med_err(*dev, "Failed to select the channels: %d", ret);
+			goto error;
+		}
+	}
+
+	ret = med_ring_init(&(*dev)->ring, frames, (*dev)->channel_count);
+	if (ret) {
+		med_err(*dev, "Failed to allocate the sample queue: %d", ret);
+		goto error;
+	}
+
+	ret = s_event(&(*dev)->event);
+	if (ret) {
+		med_err(*dev, "Failed to create the sample event: %d", ret);
+		goto error;
+	}
+
+	ret = s_event(&(*dev)->space_event);
+	if (ret) {
+		med_err(*dev, "Failed to create the space event: %d", ret);
+		goto error;
+	}
+
+	ret = s_event(&(*dev)->stop_event);
+	if (ret) {
+		med_err(*dev, "Failed to create the stop event: %d", ret);
+		goto error;
+	}
+
+	return 0;
+
+error:
+	med_eeg_destroy(*dev);
+	*dev = NULL;
+	return ret;
 }
 
 void med_eeg_destroy(struct med_eeg *dev)
 {
-	struct med_sample *next;
-
 	assert(dev);
 
-	while (dev->samples) {
-		next = dev->samples;
-		dev->samples = next->next;
-		free(next);
-	}
+	med_eeg_stop(dev);
+
+	med_ring_free(&dev->ring);
+	if (dev->event >= 0)
+		s_close(dev->event);
+	if (dev->space_event >= 0)
+		s_close(dev->space_event);
+	if (dev->stop_event >= 0)
+		s_close(dev->stop_event);
+
+	free(dev->channel_map);
 
 	if (dev->destroy)
 		dev->destroy(dev);
@@ -53,6 +211,9 @@ int med_eeg_set_mode(struct med_eeg *dev, enum med_eeg_mode mode)
 {
 	assert(dev);
 
+	if (dev->running)
+		return -EBUSY;
+
 	if (dev->set_mode)
 		return dev->set_mode(dev, mode);
 
@@ -69,42 +230,665 @@ int med_eeg_get_channels(struct med_eeg *dev, char ***labels)
 	return dev->channel_count;
 }
 
+/**
+ * med_eeg_wake_producer() - Wake up the producer blocked on a full queue.
+ */
+static void med_eeg_wake_producer(struct med_eeg *dev)
+{
+	/* Pairs with the fence in med_eeg_wait_space(). */
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (atomic_load_explicit(&dev->wait_space, memory_order_relaxed)
+	    && atomic_exchange(&dev->wait_space, false))
+		s_event_signal(dev->space_event);
+}
+
+/**
+ * med_eeg_read() - Copy the queued samples out.
+ * @samples: Output buffer.
+ * @info:    Output metadata buffer or NULL.
+ * @done:    Amount of samples already in the buffers.
+ * @count:   Total size of the buffers in samples.
+ * @planar:  Write the samples as per-channel rows of @count values.
+ *
+ * Return: Amount of samples added to the buffers.
+ */
+static unsigned int med_eeg_read(struct med_eeg *dev, float *samples,
+				 struct med_eeg_sample_info *info,
+				 unsigned int done, unsigned int count, bool planar)
+{
+	if (planar)
+		count = med_ring_read_planar(&dev->ring, &samples[done], count,
+					     info ? &info[done] : NULL, count - done);
+	else
+		count = med_ring_read(&dev->ring, &samples[done * dev->channel_count],
+				      info ? &info[done] : NULL, count - done);
+	if (count)
+		med_eeg_wake_producer(dev);
+
+	return count;
+}
+
+/**
+ * med_eeg_convert() - Convert the ADC codes read in the raw mode in place.
+ * @count:  Amount of samples in the buffer.
+ * @planar: Whether the buffer holds per-channel rows of @count values.
+ */
+static void med_eeg_convert(struct med_eeg *dev, float *samples, int count, bool planar)
+{
+	int i, j, chan_step, sample_step;
+	int32_t code;
+	float *v;
+
+	if (!dev->raw)
+		return;
+
+	chan_step = planar ? count : 1;
+	sample_step = planar ? 1 : dev->channel_count;
+
+	for (j = 0; j < dev->channel_count; ++j) {
+		v = &samples[j * chan_step];
+		for (i = 0; i < count; ++i, v += sample_step) {
+			memcpy(&code, v, sizeof(code));
+			*v = code * dev->scales[j].gain + dev->scales[j].offset;
+		}
+	}
+}
+
+/**
+ * med_eeg_wait_space() - Wait for the consumer to read the samples.
+ *
+ * Return: The next frame or NULL if the producer was stopped.
+ */
+static float *med_eeg_wait_space(struct med_eeg *dev)
+{
+	float *next;
+
+	while (dev->running) {
+		atomic_store(&dev->wait_space, true);
+		atomic_thread_fence(memory_order_seq_cst);
+
+		next = med_ring_reserve(&dev->ring);
+		if (next) {
+			atomic_store(&dev->wait_space, false);
+			return next;
+		}
+
+		s_event_wait(dev->space_event, -1);
+	}
+
+	return med_ring_reserve(&dev->ring);
+}
+
+float *med_eeg_overflow(struct med_eeg *dev)
+{
+	float *next;
+
+	switch (dev->overflow) {
+	case MED_EEG_BLOCK:
+		/*
+		 * Only a consumer on another thread can make space. An
+		 * engine worker would starve the other devices meanwhile.
+		 */
+		if (dev->running && !dev->callback && !dev->shared) {
+			next = med_eeg_wait_space(dev);
+			if (next)
+				return next;
+		}
+		/* fallthrough */
+	case MED_EEG_DROP_NEWEST:
+		return med_ring_spare(&dev->ring);
+	case MED_EEG_DROP_OLDEST:
+	default:
+		return med_ring_drop(&dev->ring);
+	}
+}
+
+/**
+ * med_eeg_dispatch() - Pass the queued samples to the user callback.
+ */
+static void med_eeg_dispatch(struct med_eeg *dev)
+{
+	unsigned int n1, n2;
+	float *p1, *p2;
+
+	if (!dev->callback || med_ring_count(&dev->ring) < dev->callback_batch)
+		return;
+
+	med_ring_peek(&dev->ring, &p1, &n1, &p2, &n2);
+
+	dev->callback(dev, p1, n1, dev->callback_data);
+	if (n2)
+		dev->callback(dev, p2, n2, dev->callback_data);
+
+	med_ring_consume(&dev->ring, n1 + n2);
+	med_eeg_wake_producer(dev);
+}
+
+/**
+ * med_eeg_receive() - Call the driver to receive the data.
+ * @max: Amount of samples the caller is interested in.
+ *
+ * Return: As the driver sample callback.
+ */
+static int med_eeg_receive(struct med_eeg *dev, unsigned int max)
+{
+	unsigned int space;
+
+	if (!dev->sample_batch)
+		return dev->sample(dev);
+
+	/* Don't let a single batch overflow the queue. */
+	space = dev->ring.size - med_ring_count(&dev->ring);
+	if (max > space)
+		max = space;
+
+	return dev->sample_batch(dev, max ? max : 1);
+}
+
+int med_eeg_sample_buffered(struct med_eeg *dev, int fd, int max)
+{
+	int ret, cnt = 0;
+
+	do {
+		ret = dev->sample(dev);
+		if (ret < 0)
+			return ret;
+
+		cnt += ret;
+		if (cnt >= max)
+			break;
+
+		ret = s_poll(fd, 0);
+		if (ret < 0)
+			return ret;
+	} while (ret);
+
+	return cnt;
+}
+
+int med_eeg_pump(struct med_eeg *dev)
+{
+	int ret;
+
+	ret = med_eeg_receive(dev, dev->ring.size);
+	if (ret < 0)
+		return ret;
+
+	med_eeg_dispatch(dev);
+
+	if (dev->notify)
+		s_event_signal(dev->event);
+
+	return ret;
+}
+
+void med_eeg_release(struct med_eeg *dev, int err)
+{
+	dev->thread_err = err;
+	dev->running = false;
+	s_event_signal(dev->event);
+	s_event_signal(dev->space_event);
+}
+
+/**
+ * med_eeg_acquire() - Acquisition thread body.
+ */
+static void *med_eeg_acquire(void *data)
+{
+	struct med_eeg *dev = data;
+	int ret = 0, fd = -1;
+
+	if (dev->get_fd)
+		fd = dev->get_fd(dev);
+
+	while (dev->running) {
+		/*
+		 * Wait for the data here rather than in the driver, so
+		 * the thread can be stopped while the device is silent.
+		 */
+		if (fd >= 0 && !med_eeg_pending(dev)) {
+			ret = s_poll_event(fd, dev->stop_event, -1);
+			if (ret < 0) {
+				med_err(dev, "Waiting for the data failed: %d", ret);
+				break;
+			}
+			if (!ret)
+				continue;
+		}
+
+		ret = med_eeg_pump(dev);
+		if (ret < 0) {
+			med_err(dev, "Acquisition stopped: %d", ret);
+			break;
+		}
+	}
+
+	med_eeg_release(dev, ret < 0 ? ret : 0);
+
+	return NULL;
+}
+
+int med_eeg_start(struct med_eeg *dev)
+{
+	int ret;
+
+	assert(dev);
+
+	if (!dev->sample)
+		return -1;
+
+	if (dev->running)
+		return -EBUSY;
+
+	/* Collect the previous thread if it has stopped on its own. */
+	if (dev->thread) {
+		pthread_join(dev->thread, NULL);
+		dev->thread = 0;
+	}
+
+	med_eeg_acquire_init(dev, false);
+	s_event_wait(dev->stop_event, 0);
+
+	ret = pthread_create(&dev->thread, NULL, med_eeg_acquire, dev);
+	if (ret) {
+		dev->running = false;
+		dev->thread = 0;
+		return -ret;
+	}
+
+	return 0;
+}
+
+int med_eeg_stop(struct med_eeg *dev)
+{
+	assert(dev);
+
+	if (!dev->thread)
+		return 0;
+
+	dev->running = false;
+	s_event_signal(dev->stop_event);
+	s_event_signal(dev->space_event);
+
+	pthread_join(dev->thread, NULL);
+	dev->thread = 0;
+
+	return dev->thread_err;
+}
+
+/**
+ * med_eeg_sample_queued() - Read samples queued by the acquisition thread.
+ * @min:     Amount of samples to wait for.
+ * @timeout: Timeout in milliseconds, negative to wait forever.
+ *
+ * Return: Amount of samples read or negative error.
+ */
+static int med_eeg_sample_queued(struct med_eeg *dev, float *samples,
+				 struct med_eeg_sample_info *info, int count,
+				 int min, int timeout, bool planar)
+{
+	unsigned int want;
+	int ret, read = 0;
+	bool running;
+
+	for (;;) {
+		/* Samples queued before the thread has stopped are still read. */
+		running = dev->running;
+
+		read += med_eeg_read(dev, samples, info, read, count, planar);
+		if (read >= min || !running || !timeout)
+			break;
+
+		/*
+		 * Tell the producer how many samples we need and check
+		 * again, so a sample added in the meantime isn't missed.
+		 * Pairs with the fence in med_eeg_add_sample().
+		 */
+		want = min - read;
+		if (want > dev->ring.size)
+			want = dev->ring.size;
+
+		atomic_store(&dev->wait_frames, want);
+		atomic_thread_fence(memory_order_seq_cst);
+
+		if (med_ring_count(&dev->ring) >= want || !dev->running) {
+			atomic_store(&dev->wait_frames, 0);
+			continue;
+		}
+
+		ret = s_event_wait(dev->event, timeout);
+		if (ret == -ETIMEDOUT) {
+			atomic_store(&dev->wait_frames, 0);
+			break;
+		}
+		if (ret < 0)
+			return ret;
+	}
+
+	if (read < min && !running)
+		return dev->thread_err ? dev->thread_err : -EPIPE;
+
+	return read;
+}
+
 int med_eeg_sample(struct med_eeg *dev, float *samples, int count)
 {
-	struct med_sample *next;
-	int ret, i;
+	return med_eeg_sample_ts(dev, samples, NULL, count);
+}
+
+/**
+ * med_eeg_sample_frames() - Read samples blocking, as they are queued.
+ */
+static int med_eeg_sample_frames(struct med_eeg *dev, float *samples,
+				 struct med_eeg_sample_info *info, int count, bool planar)
+{
+	int ret, read = 0;
 
 	assert(dev);
 
 	if (!dev->sample)
 		return -1;
 
+	if (dev->callback && count)
+		return -EINVAL;
+
+	if (dev->running)
+		return med_eeg_sample_queued(dev, samples, info, count, count, -1, planar);
+
+	/*
+	 * Drain the queue as it fills so the request may be larger
+	 * than the queue capacity. The samples already queued, e.g.
+	 * the rest of a multi-sample packet, are taken first.
+	 */
+	read = med_eeg_read(dev, samples, info, read, count, planar);
+
+	while (read < count) {
+		ret = med_eeg_receive(dev, count - read);
+		if (ret < 0)
+			return ret;
+
+		med_eeg_dispatch(dev);
+
+		read += med_eeg_read(dev, samples, info, read, count, planar);
+	}
+
+	return count;
+}
+
+int med_eeg_sample_ts(struct med_eeg *dev, float *samples,
+		      struct med_eeg_sample_info *info, int count)
+{
+	int ret;
+
+	ret = med_eeg_sample_frames(dev, samples, info, count, false);
+	if (ret > 0)
+		med_eeg_convert(dev, samples, ret, false);
+
+	return ret;
+}
+
+int med_eeg_sample_planar(struct med_eeg *dev, float *samples, int count)
+{
+	int ret;
+
+	ret = med_eeg_sample_frames(dev, samples, NULL, count, true);
+	if (ret > 0)
+		med_eeg_convert(dev, samples, ret, true);
+
+	return ret;
+}
+
+int med_eeg_sample_raw(struct med_eeg *dev, int32_t *samples, int count)
+{
+	assert(dev);
+
+	if (!dev->raw)
+		return -EINVAL;
+
+	/* The queue cells are copied out bit-exact. */
+	return med_eeg_sample_frames(dev, (float *)samples, NULL, count, false);
+}
+
+/**
+ * med_eeg_sample_avail() - Read the available samples, as they are queued.
+ */
+static int med_eeg_sample_avail(struct med_eeg *dev, float *samples, int count, int timeout)
+{
+	int ret, fd = -1, read = 0;
+
+	assert(dev);
+
+	if (!dev->sample || count < 0)
+		return -1;
+
+	if (dev->callback && count)
+		return -EINVAL;
+
+	if (dev->running) {
+		/* Reset the event for the level-triggered pollers. */
+		if (dev->notify)
+			s_event_wait(dev->event, 0);
+
+		return med_eeg_sample_queued(dev, samples, NULL, count, count ? 1 : 0,
+					     timeout, false);
+	}
+
+	read = med_eeg_read(dev, samples, NULL, 0, count, false);
+	if (count && read == count)
+		return read;
+
+	if (dev->get_fd)
+		fd = dev->get_fd(dev);
+
+	/*
+	 * Only call the driver while it has data pending, only the
+	 * first check may wait. Drivers without an fd never block.
+	 */
 	do {
-		ret = dev->sample(dev);
+		if (fd >= 0 && !med_eeg_pending(dev)) {
+			ret = s_poll(fd, read ? 0 : timeout);
+			if (ret < 0)
+				return ret;
+			if (!ret)
+				break;
+			timeout = 0;
+		}
+
+		ret = med_eeg_receive(dev, count - read);
 		if (ret < 0)
 			return ret;
-	} while (dev->sample_count < count);
 
-	for (i = 0; i < count; ++i) {
-		next = dev->samples;
-		memcpy(samples, next->data, next->len * sizeof(next->data[0]));
-		samples += next->len;
-		dev->samples = next->next;
-		free(next);
-		dev->sample_count--;
+		med_eeg_dispatch(dev);
+
+		read += med_eeg_read(dev, samples, NULL, read, count, false);
+	} while (read < count);
+
+	return read;
+}
+
+int med_eeg_sample_timeout(struct med_eeg *dev, float *samples, int count, int timeout)
+{
+	int ret;
+
+	ret = med_eeg_sample_avail(dev, samples, count, timeout);
+	if (ret > 0)
+		med_eeg_convert(dev, samples, ret, false);
+
+	return ret;
+}
+
+int med_eeg_sample_nb(struct med_eeg *dev, float *samples, int count)
+{
+	return med_eeg_sample_timeout(dev, samples, count, 0);
+}
+
+int med_eeg_get_scales(struct med_eeg *dev, struct med_eeg_scale *scales)
+{
+	assert(dev);
+
+	if (!dev->scales)
+		return -1;
+
+	memcpy(scales, dev->scales, sizeof(*scales) * dev->channel_count);
+
+	return dev->channel_count;
+}
+
+int med_eeg_get_fd(struct med_eeg *dev)
+{
+	assert(dev);
+
+	if (dev->running) {
+		dev->notify = true;
+		return dev->event;
+	}
+
+	if (dev->get_fd)
+		return dev->get_fd(dev);
+
+	return -1;
+}
+
+int med_eeg_set_callback(struct med_eeg *dev,
+		void (*fn)(struct med_eeg *dev, const float *samples, int count, void *user),
+		void *user, int min_batch)
+{
+	assert(dev);
+
+	if (dev->running)
+		return -EBUSY;
+
+	if (min_batch < 1 || (unsigned int)min_batch > dev->ring.size)
+		return -EINVAL;
+
+	dev->callback = fn;
+	dev->callback_data = user;
+	dev->callback_batch = min_batch;
+
+	return 0;
+}
+
+int med_eeg_set_queue(struct med_eeg *dev, int capacity, enum med_eeg_overflow policy)
+{
+	struct med_ring ring;
+	int ret;
+
+	assert(dev);
+
+	if (dev->running)
+		return -EBUSY;
+
+	if (policy < MED_EEG_DROP_OLDEST || policy > MED_EEG_BLOCK)
+		return -EINVAL;
+
+	/* The callback would never see a full batch. */
+	if (dev->callback && capacity > 0 && (unsigned int)capacity < dev->callback_batch)
+		return -EINVAL;
+
+	if (capacity > 0) {
+		ret = med_ring_init(&ring, capacity, dev->channel_count);
+		if (ret)
+			return ret;
+
+		med_ring_free(&dev->ring);
+		dev->ring = ring;
 	}
 
+	dev->overflow = policy;
+
+	return 0;
+}
+
+int med_eeg_get_stats(struct med_eeg *dev, struct med_eeg_stats *stats)
+{
+	assert(dev);
+
+	if (!stats)
+		return -EINVAL;
+
+	stats->received = atomic_load(&dev->ring.received);
+	stats->dropped = atomic_load(&dev->ring.dropped);
+	stats->lost = atomic_load(&dev->lost);
+	stats->queued = med_ring_count(&dev->ring);
+	stats->capacity = dev->ring.size;
+
+	return 0;
+}
+
+int med_eeg_peek(struct med_eeg *dev, const float **data, int *count,
+		 const float **wrap, int *wrap_count)
+{
+	unsigned int n1, n2, avail;
+	float *p1, *p2;
+
+	assert(dev);
+
+	if (!data || !count)
+		return -EINVAL;
+
+	/* The producer would overwrite the samples in place. */
+	if (dev->running && dev->overflow == MED_EEG_DROP_OLDEST)
+		return -EBUSY;
+
+	avail = med_ring_peek(&dev->ring, &p1, &n1, &p2, &n2);
+
+	*data = p1;
+	*count = n1;
+
+	if (!wrap)
+		return n1;
+
+	*wrap = p2;
+	if (wrap_count)
+		*wrap_count = n2;
+
+	return avail;
+}
+
+int med_eeg_consume(struct med_eeg *dev, int count)
+{
+	assert(dev);
+
+	if (count < 0)
+		return -EINVAL;
+
+	count = med_ring_consume(&dev->ring, count);
+	med_eeg_wake_producer(dev);
+
 	return count;
 }
 
 int med_eeg_get_impedance(struct med_eeg *dev, float *samples)
 {
+	int i, ret;
+	float *tmp;
+
 	assert(dev);
 
-	if (dev->get_impedance)
+	if (dev->running)
+		return -EBUSY;
+
+	if (!dev->get_impedance)
+		return -1;
+
+	if (!dev->channel_map)
 		return dev->get_impedance(dev, samples);
 
-	return -1;
+	/* The drivers measure all the device channels. */
+	tmp = malloc(sizeof(*tmp) * dev->source_count);
+	if (!tmp)
+		return -ENOMEM;
+
+	ret = dev->get_impedance(dev, tmp);
+	if (ret >= 0) {
+		for (i = 0; i < dev->channel_count; ++i)
+			samples[i] = tmp[dev->channel_map[i]];
+		ret = dev->channel_count;
+	}
+
+	free(tmp);
+	return ret;
 }
 
 
@@ -0,0 +1,278 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+/*
+ * engine.c - Acquisition engine for multiple devices.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+
+#include <system/system.h>
+#include <med/eeg_priv.h>
+#include <med/engine.h>
+
+#define MED_ENGINE_EVENTS 16
+
+/**
+ * struct med_engine - Acquisition engine.
+ * @poller:       Poller that watches all the device descriptors.
+ * @event:        Wakes up the workers when the engine is stopped.
+ * @thread_count: Amount of worker threads to start.
+ * @started:      Amount of worker threads actually started.
+ * @threads:      The worker threads.
+ * @running:      Whether the workers are active.
+ * @dev_count:    Amount of registered devices.
+ * @devs:         Registered devices.
+ */
+struct med_engine {
+	int poller;
+	int event;
+
+	int thread_count;
+	int started;
+	pthread_t *threads;
+	atomic_bool running;
+
+	int dev_count;
+	struct med_eeg **devs;
+};
+
+/**
+ * med_engine_work() - Worker thread body.
+ *
+ * The device descriptors are watched in oneshot mode so only one
+ * worker at a time services a device, as the sample queue has a
+ * single producer. The descriptor is re-armed once the driver is done
+ * and has no complete packets left in its buffer.
+ */
+static void *med_engine_work(void *data)
+{
+	struct med_engine *eng = data;
+	void *ready[MED_ENGINE_EVENTS];
+	struct med_eeg *dev;
+	int i, cnt, ret;
+
+	while (eng->running) {
+		cnt = s_poller_wait(eng->poller, ready, MED_ENGINE_EVENTS, -1);
+		if (cnt < 0) {
+			s_dprintf(CRITICAL, "[engine] poller failed: %d\n", cnt);
+			break;
+		}
+
+		for (i = 0; i < cnt; ++i) {
+			dev = ready[i];
+			if (!dev || !eng->running)
+				continue;
+
+			/* The data the driver has buffered won't wake us up again. */
+			do {
+				ret = med_eeg_pump(dev);
+			} while (ret >= 0 && med_eeg_pending(dev));
+
+			if (ret < 0) {
+				med_err(dev, "Acquisition stopped: %d", ret);
+				med_eeg_release(dev, ret);
+				continue;
+			}
+
+			ret = s_poller_rearm(eng->poller, dev->get_fd(dev), dev);
+			if (ret < 0) {
+				med_err(dev, "Failed to re-arm the device: %d", ret);
+				med_eeg_release(dev, ret);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+int med_engine_create(struct med_engine **eng, int threads)
+{
+	int ret;
+
+	(*eng) = malloc(sizeof(**eng));
+	if (!*eng)
+		return -ENOMEM;
+
+	memset(*eng, 0, sizeof(**eng));
+
+	(*eng)->thread_count = threads > 0 ? threads : s_cpu_count();
+	(*eng)->threads = malloc(sizeof(pthread_t) * (*eng)->thread_count);
+	(*eng)->event = -1;
+
+	if (!(*eng)->threads) {
+		ret = -ENOMEM;
+		goto error_poller;
+	}
+
+	ret = s_poller(&(*eng)->poller);
+	if (ret < 0)
+		goto error_poller;
+
+	ret = s_event(&(*eng)->event);
+	if (ret < 0)
+		goto error_event;
+
+	/* The stop event is level-triggered, so it wakes up every worker. */
+	ret = s_poller_add((*eng)->poller, (*eng)->event, NULL, 0);
+	if (ret < 0)
+		goto error_add;
+
+	return 0;
+
+error_add:
+	s_close((*eng)->event);
+error_event:
+	s_close((*eng)->poller);
+error_poller:
+	free((*eng)->threads);
+	free(*eng);
+	*eng = NULL;
+	return ret;
+}
+
+void med_engine_destroy(struct med_engine *eng)
+{
+	assert(eng);
+
+	med_engine_stop(eng);
+
+	s_close(eng->event);
+	s_close(eng->poller);
+
+	free(eng->devs);
+	free(eng->threads);
+	free(eng);
+}
+
+int med_engine_add(struct med_engine *eng, struct med_eeg *dev)
+{
+	struct med_eeg **devs;
+	int i;
+
+	assert(eng);
+	assert(dev);
+
+	if (eng->running)
+		return -EBUSY;
+
+	if (!dev->sample || !dev->get_fd || dev->get_fd(dev) < 0) {
+		med_err(dev, "The device can't be polled.");
+		return -EINVAL;
+	}
+
+	for (i = 0; i < eng->dev_count; ++i)
+		if (eng->devs[i] == dev)
+			return -EEXIST;
+
+	devs = realloc(eng->devs, sizeof(*devs) * (eng->dev_count + 1));
+	if (!devs)
+		return -ENOMEM;
+
+	devs[eng->dev_count++] = dev;
+	eng->devs = devs;
+
+	return 0;
+}
+
+int med_engine_remove(struct med_engine *eng, struct med_eeg *dev)
+{
+	int i;
+
+	assert(eng);
+
+	if (eng->running)
+		return -EBUSY;
+
+	for (i = 0; i < eng->dev_count; ++i) {
+		if (eng->devs[i] != dev)
+			continue;
+
+		eng->devs[i] = eng->devs[--eng->dev_count];
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+int med_engine_start(struct med_engine *eng)
+{
+	int i, ret;
+
+	assert(eng);
+
+	if (eng->running)
+		return -EBUSY;
+
+	for (i = 0; i < eng->dev_count; ++i)
+		if (eng->devs[i]->running)
+			return -EBUSY;
+
+	s_event_wait(eng->event, 0);
+
+	for (i = 0; i < eng->dev_count; ++i) {
+		med_eeg_acquire_init(eng->devs[i], true);
+
+		ret = s_poller_add(eng->poller, eng->devs[i]->get_fd(eng->devs[i]),
+				   eng->devs[i], 1);
+		if (ret < 0) {
+			med_err(eng->devs[i], "Failed to watch the device: %d", ret);
+			med_eeg_release(eng->devs[i], 0);
+			goto error_devs;
+		}
+	}
+
+	eng->running = true;
+
+	for (eng->started = 0; eng->started < eng->thread_count; ++eng->started) {
+		ret = pthread_create(&eng->threads[eng->started], NULL, med_engine_work, eng);
+		if (ret) {
+			med_engine_stop(eng);
+			return -ret;
+		}
+	}
+
+	s_dprintf(INFO, "[engine] Started %d devices on %d threads\n",
+		  eng->dev_count, eng->started);
+
+	return 0;
+
+error_devs:
+	while (i--) {
+		s_poller_del(eng->poller, eng->devs[i]->get_fd(eng->devs[i]));
+		med_eeg_release(eng->devs[i], 0);
+	}
+	return ret;
+}
+
+void med_engine_stop(struct med_engine *eng)
+{
+	int i;
+
+	assert(eng);
+
+	if (!eng->running)
+		return;
+
+	eng->running = false;
+	s_event_signal(eng->event);
+
+	/*
+	 * The devices are handed back only once no worker may be in the
+	 * driver anymore, the queue must not get a second producer.
+	 */
+	for (i = 0; i < eng->started; ++i)
+		pthread_join(eng->threads[i], NULL);
+
+	eng->started = 0;
+
+	/* Keep the error of a device that has failed on its own. */
+	for (i = 0; i < eng->dev_count; ++i)
+		if (eng->devs[i]->running)
+			med_eeg_release(eng->devs[i], 0);
+
+	for (i = 0; i < eng->dev_count; ++i)
+		s_poller_del(eng->poller, eng->devs[i]->get_fd(eng->devs[i]));
+}
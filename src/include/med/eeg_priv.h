@@ -2,76 +2,247 @@
 #ifndef EEG_PRIV_H
 #define EEG_PRIV_H
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
 #include <system/system.h>
 #include <med/eeg.h>
-
-/**
- * struct med_sample - Internal sample storage.
- */
-struct med_sample {
-	struct med_sample *next;
-	int seq;
-	int len;
-	float data[];
-};
+#include <med/ring.h>
 
 /**
  * struct med_eeg - EEG device.
  * @type:           Type of the device.
  * @channel_count:  Amount of channels in the sample.
  * @channel_labels: An array of labels for the channels.
- * @sample_count:   Ammount of ready samples.
- * @samples:        A list of already acquired samples.
- * @samples_tail:   The end of the sample list to append to.
+ * @source_count:   Amount of channels the device provides.
+ * @channel_map:    Index of the device channel for each channel, or NULL
+ *                  if all the @source_count channels are used.
+ * @scales:         Conversion of the ADC codes to physical units per channel.
+ * @raw:            Queue the ADC codes instead of the converted values.
+ * @ring:           Queue of already acquired samples.
+ * @event:          Wakes up the consumer waiting for samples.
+ * @wait_frames:    Amount of samples the consumer is waiting for.
+ * @overflow:       What to do when @ring is full.
+ * @space_event:    Wakes up the producer waiting for free space.
+ * @wait_space:     Whether the producer is waiting for free space.
+ * @thread:         Background acquisition thread.
+ * @stop_event:     Wakes up the acquisition thread waiting for the data.
+ * @running:        Whether the acquisition thread or an engine owns the device.
+ * @shared:         The producer is an engine worker that serves other devices too.
+ * @thread_err:     The error that stopped the acquisition thread.
+ * @notify:         Signal @event after every batch for external pollers.
+ * @callback:       User callback that consumes the samples.
+ * @callback_data:  Opaque pointer to pass to @callback.
+ * @callback_batch: Minimal amount of samples to pass to @callback.
  * @destroy:        Unprepare and destroy the resources.
  * @set_mode:       Set the device mode.
  * @sample:         Read currently available samples into the sample buffer.
+ * @sample_batch:   Same as @sample, but keep reading the samples that are
+ *                  already buffered until up to the given amount is queued.
+ *                  Optional, used instead of @sample when set.
  * @get_impedance:  Read out impedance on all possible cahnnels to the user.
+ * @get_fd:         Get the file descriptor that becomes readable with new data.
+ * @pending:        Whether the driver has complete packets buffered, which
+ *                  are decoded without @get_fd becoming readable. Optional.
  */
 struct med_eeg {
 	char *type;
 
 	int channel_count;
 	char **channel_labels;
+	int source_count;
+	int *channel_map;
+	struct med_eeg_scale *scales;
+	bool raw;
+
+	struct med_ring ring;
+	atomic_ullong lost;
+	int event;
+	atomic_uint wait_frames;
+
+	enum med_eeg_overflow overflow;
+	int space_event;
+	atomic_bool wait_space;
 
-	int sample_count;
-	struct med_sample *samples;
-	struct med_sample *samples_tail;
+	pthread_t thread;
+	int stop_event;
+	atomic_bool running;
+	bool shared;
+	int thread_err;
+	atomic_bool notify;
+
+	void (*callback)(struct med_eeg *dev, const float *samples, int count, void *user);
+	void *callback_data;
+	unsigned int callback_batch;
 
 	void (*destroy)(struct med_eeg *dev);
 	int (*set_mode)(struct med_eeg *dev, enum med_eeg_mode mode);
 	int (*sample)(struct med_eeg *dev);
+	int (*sample_batch)(struct med_eeg *dev, int max);
 	int (*get_impedance)(struct med_eeg *dev, float *samples);
+	int (*get_fd)(struct med_eeg *dev);
+	bool (*pending)(struct med_eeg *dev);
 };
 
 /**
- * med_eeg_alloc_sample() - Allocate a sample
+ * med_eeg_overflow() - Get a sample slot when the queue is full.
+ *
+ * Applies the overflow policy of the device, which may drop a
+ * sample or wait for the consumer.
+ */
+float *med_eeg_overflow(struct med_eeg *dev);
+
+/**
+ * med_eeg_alloc_sample() - Reserve the next sample slot in the queue.
+ *
+ * The driver shall write channel_count values into the returned
+ * frame and then call med_eeg_add_sample(). If the sample is not
+ * needed after all, the slot can simply be abandoned.
  */
-static inline struct med_sample *med_eeg_alloc_sample(struct med_eeg *dev)
+static inline float *med_eeg_alloc_sample(struct med_eeg *dev)
 {
-	struct med_sample *next;
+	float *next = med_ring_reserve(&dev->ring);
 
-	next = malloc(sizeof(*next) + sizeof(float) * dev->channel_count);
-	next->len = dev->channel_count;
-	next->next = NULL;
+	return next ? next : med_eeg_overflow(dev);
+}
 
-	return next;
+/**
+ * med_eeg_lost() - Account for samples lost before they reached the host.
+ * @count: Amount of samples missing in the device sequence.
+ *
+ * Shall only be called by the driver, i.e. the producer.
+ */
+static inline void med_eeg_lost(struct med_eeg *dev, unsigned long long count)
+{
+	unsigned long long cnt = atomic_load_explicit(&dev->lost, memory_order_relaxed);
+
+	atomic_store_explicit(&dev->lost, cnt + count, memory_order_relaxed);
+}
+
+/**
+ * med_eeg_recovered() - Take back the lost samples the device sent again.
+ * @count: Amount of samples queued after med_eeg_lost() accounted them.
+ *
+ * Shall only be called by the driver, i.e. the producer.
+ */
+static inline void med_eeg_recovered(struct med_eeg *dev, unsigned long long count)
+{
+	unsigned long long cnt = atomic_load_explicit(&dev->lost, memory_order_relaxed);
+
+	atomic_store_explicit(&dev->lost, cnt - count, memory_order_relaxed);
+}
+
+/**
+ * med_eeg_chan() - Get the device channel to decode into a frame position.
+ * @idx: Index of the channel in the frame.
+ *
+ * The drivers shall fill the frame positions from zero to channel_count
+ * and look up the device channel of each one, so only the channels
+ * selected by the user are decoded.
+ */
+static inline int med_eeg_chan(const struct med_eeg *dev, int idx)
+{
+	return dev->channel_map ? dev->channel_map[idx] : idx;
 }
 
 /**
- * med_eeg_add_sample() - Insert the newly created sample to the queue.
+ * med_eeg_put_code() - Write a channel value into the sample frame.
+ * @frame: Frame returned by med_eeg_alloc_sample().
+ * @chan:  Index of the channel.
+ * @code:  The ADC code as received from the device.
+ *
+ * Stores the code as is in the raw mode, or converted using the
+ * channel scale otherwise.
  */
-static inline void med_eeg_add_sample(struct med_eeg *dev, struct med_sample *next)
+static inline void med_eeg_put_code(struct med_eeg *dev, float *frame, int chan, int32_t code)
 {
-	if (!dev->samples)
-		dev->samples = next;
+	if (dev->raw)
+		memcpy(&frame[chan], &code, sizeof(code));
 	else
-		dev->samples_tail->next = next;
+		frame[chan] = code * dev->scales[chan].gain + dev->scales[chan].offset;
+}
+
+/**
+ * med_eeg_add_sample() - Insert the newly written sample to the queue.
+ * @seq: Monotonic sequence number of the sample.
+ *
+ * The drivers should derive @seq from the device packet counter
+ * if there is one, so the user can detect the lost samples.
+ */
+static inline void med_eeg_add_sample(struct med_eeg *dev, unsigned long long seq)
+{
+	unsigned int wait;
+
+	med_ring_commit(&dev->ring, seq, s_time_ns());
+
+	/* Pairs with the fence in med_eeg_sample_queued(). */
+	atomic_thread_fence(memory_order_seq_cst);
+
+	wait = atomic_load_explicit(&dev->wait_frames, memory_order_relaxed);
+	if (wait && med_ring_count(&dev->ring) >= wait
+	    && atomic_exchange(&dev->wait_frames, 0))
+		s_event_signal(dev->event);
+}
+
+/**
+ * med_eeg_pending() - Check whether the driver can decode data right away.
+ *
+ * The driver fd doesn't need to be polled then, the data was already
+ * taken from it.
+ */
+static inline bool med_eeg_pending(struct med_eeg *dev)
+{
+	return dev->pending && dev->pending(dev);
+}
+
+/**
+ * med_eeg_sample_buffered() - Receive the samples that are already buffered.
+ * @fd:  The descriptor the driver reads from.
+ * @max: Amount of samples to stop at.
+ *
+ * A generic @sample_batch implementation: calls the driver @sample once
+ * and then again as long as @fd is readable and less than @max samples
+ * were received.
+ *
+ * Return: Amount of samples received or negative error.
+ */
+int med_eeg_sample_buffered(struct med_eeg *dev, int fd, int max);
 
-	dev->samples_tail = next;
-	dev->sample_count++;
+/**
+ * med_eeg_acquire_init() - Prepare the device for an external producer.
+ * @shared: The producer also serves other devices, so it must never
+ *          wait for the consumer.
+ *
+ * After this call the device is owned by the producer (the acquisition
+ * thread or the engine) and med_eeg_sample() only consumes the samples.
+ */
+static inline void med_eeg_acquire_init(struct med_eeg *dev, bool shared)
+{
+	dev->thread_err = 0;
+	dev->notify = false;
+	dev->shared = shared;
+	dev->running = true;
 }
 
+/**
+ * med_eeg_pump() - Receive the data and deliver it to the user.
+ *
+ * Calls the driver once, passes the samples to the user callback
+ * if needed and wakes up the pollers.
+ *
+ * Return: As the driver sample callback.
+ */
+int med_eeg_pump(struct med_eeg *dev);
+
+/**
+ * med_eeg_release() - Give the device back from the producer.
+ * @err: The error that has stopped the producer or zero.
+ */
+void med_eeg_release(struct med_eeg *dev, int err);
+
 /* debug print helpers */
 #define med_err(dev, fmt, ...) \
 	s_dprintf(CRITICAL, "[%s] %s:%d: " fmt "\n", \
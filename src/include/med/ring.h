@@ -0,0 +1,235 @@
+/* SPDX-License-Identifier: GPL-3.0-only */
+#ifndef MED_RING_H
+#define MED_RING_H
+
+/*
+ * ring.h - Contiguous frame-interleaved sample storage.
+ *
+ * The ring is a single-producer single-consumer queue: the driver
+ * (possibly on the acquisition thread) writes the frames and the
+ * user reads them. No locks are taken, the indices are published
+ * with acquire/release atomics instead.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include <med/eeg.h>
+
+/* Default ring capacity in frames. */
+#define MED_RING_DEFAULT_FRAMES 4096
+
+#define MED_CACHELINE_SIZE 64
+
+/**
+ * struct med_ring - Fixed capacity ring of sample frames.
+ * @data:     Backing storage for @size frames of @stride values.
+ * @spare:    Extra frame to write the discarded data to.
+ * @info:     Metadata of each frame in @data.
+ * @size:     Capacity of the ring in frames, always a power of two.
+ * @stride:   Amount of values in a single frame.
+ * @head:     Free-running index of the next frame to be written.
+ * @discard:  Whether the reserved frame is @spare.
+ * @received: Total amount of frames written by the producer.
+ * @dropped:  Total amount of frames lost due to overflow.
+ * @tail:     Free-running index of the oldest unread frame.
+ *
+ * The indices are never wrapped explicitly, the position in the
+ * storage is derived by masking them with (@size - 1). This way
+ * the amount of queued frames is always (@head - @tail).
+ *
+ * @head is only written by the producer and @tail is normally only
+ * written by the consumer, so they are kept on separate cache lines.
+ * The exception is a full ring: the producer may drop the oldest
+ * frame by moving @tail, which is why the consumer advances it with
+ * compare-and-swap.
+ */
+struct med_ring {
+	/* Read-only after init. */
+	union {
+		struct {
+			float *data;
+			float *spare;
+			struct med_eeg_sample_info *info;
+			unsigned int size;
+			unsigned int stride;
+		};
+		char __line0[MED_CACHELINE_SIZE];
+	};
+
+	/* Written by the producer. */
+	union {
+		struct {
+			atomic_uint head;
+			bool discard;
+			atomic_ullong received;
+			atomic_ullong dropped;
+		};
+		char __line1[MED_CACHELINE_SIZE];
+	};
+
+	/* Written by the consumer. */
+	union {
+		atomic_uint tail;
+		char __line2[MED_CACHELINE_SIZE];
+	};
+};
+
+/**
+ * med_ring_init() - Allocate the ring storage.
+ * @ring:   The ring to initialize.
+ * @frames: Minimal capacity in frames, rounded up to a power of two.
+ * @stride: Amount of values in a single frame.
+ *
+ * Return: Zero on success or negative errno.
+ */
+int med_ring_init(struct med_ring *ring, unsigned int frames, unsigned int stride);
+
+/**
+ * med_ring_free() - Release the ring storage.
+ */
+void med_ring_free(struct med_ring *ring);
+
+/**
+ * med_ring_count() - Amount of frames ready to be read.
+ */
+static inline unsigned int med_ring_count(struct med_ring *ring)
+{
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	return head - tail;
+}
+
+/**
+ * med_ring_frame() - Get a pointer to the frame with the given index.
+ */
+static inline float *med_ring_frame(const struct med_ring *ring, unsigned int idx)
+{
+	return &ring->data[(idx & (ring->size - 1)) * ring->stride];
+}
+
+/**
+ * med_ring_reserve() - Get the next frame to be written.
+ *
+ * The frame becomes visible to the reader only after med_ring_commit().
+ *
+ * Return: Pointer to the frame storage or NULL if the ring is full.
+ */
+static inline float *med_ring_reserve(struct med_ring *ring)
+{
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+	if (head - tail == ring->size)
+		return NULL;
+
+	return med_ring_frame(ring, head);
+}
+
+/**
+ * med_ring_drop() - Drop the oldest frame and get the next frame to be written.
+ *
+ * Return: Pointer to the frame storage.
+ */
+float *med_ring_drop(struct med_ring *ring);
+
+/**
+ * med_ring_spare() - Get a frame that will be discarded on commit.
+ *
+ * Return: Pointer to the frame storage.
+ */
+static inline float *med_ring_spare(struct med_ring *ring)
+{
+	ring->discard = true;
+
+	return ring->spare;
+}
+
+/**
+ * med_ring_commit() - Publish the frame returned by med_ring_reserve().
+ * @ring:      The ring to act on.
+ * @seq:       Sequence number of the frame.
+ * @timestamp: Receive time of the frame.
+ */
+static inline void med_ring_commit(struct med_ring *ring, unsigned long long seq,
+				   long long timestamp)
+{
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	struct med_eeg_sample_info *info;
+	unsigned long long cnt;
+
+	if (ring->discard) {
+		ring->discard = false;
+		cnt = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+		atomic_store_explicit(&ring->dropped, cnt + 1, memory_order_relaxed);
+		return;
+	}
+
+	info = &ring->info[head & (ring->size - 1)];
+	info->seq = seq;
+	info->timestamp = timestamp;
+
+	/* Only the producer writes the counters, no need for an atomic add. */
+	cnt = atomic_load_explicit(&ring->received, memory_order_relaxed);
+	atomic_store_explicit(&ring->received, cnt + 1, memory_order_relaxed);
+
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * med_ring_peek() - Get the oldest frames without copying them.
+ * @ring:    The ring to look at.
+ * @first:   Pointer to return the oldest frame to.
+ * @nfirst:  Amount of contiguous frames at @first.
+ * @second:  Pointer to return the wrapped continuation to.
+ * @nsecond: Amount of contiguous frames at @second.
+ *
+ * The queued frames may wrap around the end of the storage, in which
+ * case they are returned as two spans. @second is set to NULL if there
+ * is no wrapped part.
+ *
+ * Return: Total amount of frames available.
+ */
+unsigned int med_ring_peek(struct med_ring *ring,
+			   float **first, unsigned int *nfirst,
+			   float **second, unsigned int *nsecond);
+
+/**
+ * med_ring_consume() - Release the oldest frames.
+ * @ring:  The ring to act on.
+ * @count: Amount of frames to release.
+ *
+ * Return: Amount of frames released.
+ */
+unsigned int med_ring_consume(struct med_ring *ring, unsigned int count);
+
+/**
+ * med_ring_read() - Copy the oldest frames out of the ring.
+ * @ring:  The ring to read from.
+ * @dst:   Buffer that fits (@count * @ring->stride) values.
+ * @info:  Buffer that fits @count metadata entries, can be NULL.
+ * @count: Maximum amount of frames to read.
+ *
+ * Return: Amount of frames copied.
+ */
+unsigned int med_ring_read(struct med_ring *ring, float *dst,
+			   struct med_eeg_sample_info *info, unsigned int count);
+
+/**
+ * med_ring_read_planar() - Copy the oldest frames out of the ring per channel.
+ * @ring:  The ring to read from.
+ * @dst:   The first value of the first channel row.
+ * @ld:    Distance between the channel rows in values, at least @count.
+ * @info:  Buffer that fits @count metadata entries, can be NULL.
+ * @count: Maximum amount of frames to read.
+ *
+ * Same as med_ring_read(), but value i of frame j is written to
+ * (@dst[i * @ld + j]).
+ *
+ * Return: Amount of frames copied.
+ */
+unsigned int med_ring_read_planar(struct med_ring *ring, float *dst, unsigned int ld,
+				  struct med_eeg_sample_info *info, unsigned int count);
+
+#endif /* MED_RING_H */
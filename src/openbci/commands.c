@@ -16,6 +16,29 @@
 #include "packets.h"
 #include "OpenBCI_32bit_Library_Definitions.h"
 
+/**
+ * obci_chan_cfg_defaults() - Set the configuration shadow to the power-on defaults.
+ */
+static void obci_chan_cfg_defaults(struct obci_dev *dev)
+{
+	const struct obci_chan_cfg def = {
+		.powerdown = false,
+		.gain = OPENBCI_CHANNEL_CMD_GAIN_24,
+		.input_type = OPENBCI_CHANNEL_CMD_ADC_Normal,
+		.bias = true,
+		.srb2 = true,
+		.srb1 = false,
+		.leadoff_p = false,
+		.leadoff_n = false,
+	};
+	int i;
+
+	for (i = 0; i < OPENBCI_MAX_CHANS; ++i)
+		dev->chan_cfg[i] = def;
+
+	dev->chan_cfg_valid = true;
+}
+
 /**
  * obci_reset() - Reset the board.
  */
@@ -28,25 +51,31 @@ int obci_reset(struct obci_dev *dev)
 	if (ret < 0)
 		return ret;
 
+	dev->chan_cfg_valid = false;
+
 	ret = obci_text_cmd(dev, OPENBCI_MISC_SOFT_RESET, buf, sizeof(buf));
 	if (ret < 0)
 		return ret;
 
 	med_dbg(&dev->edev, "Got version header:\n%s\n", buf);
 
+	obci_chan_cfg_defaults(dev);
+
 	return 0;
 }
 
 /**
  * obci_get_version() - Read the device version.
+ * @timeout: Longest wait for the reply in milliseconds, negative to block.
  */
-int obci_get_version(struct obci_dev *dev)
+int obci_get_version(struct obci_dev *dev, int timeout)
 {
+	char cmd[] = {OPENBCI_GET_VERSION, 0};
 	unsigned char buf[64] = {0};
 	int major, minor, patch;
 	int ret;
 
-	ret = obci_text_cmd(dev, OPENBCI_GET_VERSION, buf, sizeof(buf));
+	ret = obci_text_query(dev, cmd, buf, sizeof(buf), timeout);
 	if (ret < 0)
 		return ret;
 
@@ -56,7 +85,29 @@ int obci_get_version(struct obci_dev *dev)
 
 	med_info(&dev->edev, "OpenBCI firmware version: v%d.%d.%d\n", major, minor, patch);
 	
-	return (major << 16) & (minor << 8) & patch;
+	return (major << 16) | (minor << 8) | patch;
+}
+
+/**
+ * obci_attach() - Take over a board that is already up.
+ *
+ * The streaming is stopped and the version is queried, if the board
+ * answers in time it's usable as it is and doesn't need the reset.
+ * Its channel configuration is unknown though.
+ *
+ * Return: Firmware version or negative errno if the board doesn't answer.
+ */
+int obci_attach(struct obci_dev *dev)
+{
+	int ret;
+
+	dev->chan_cfg_valid = false;
+
+	ret = obci_set_streaming(dev, false);
+	if (ret < 0)
+		return ret;
+
+	return obci_get_version(dev, OPENBCI_ATTACH_TIMEOUT);
 }
 
 /**
@@ -87,6 +138,9 @@ int obci_set_max_channels(struct obci_dev *dev, int channels)
 	unsigned char buf[64] = {0};
 	int ret;
 
+	/* Attaching the Daisy brings up its channels in an unknown state. */
+	dev->chan_cfg_valid = false;
+
 	switch (channels) {
 		case 8:
 			return obci_text_cmd(dev, OPENBCI_CHANNEL_MAX_NUMBER_8, buf, sizeof(buf));
@@ -116,6 +170,11 @@ int obci_set_streaming(struct obci_dev *dev, bool streaming)
 	int ret;
 
 	dev->is_streaming = streaming;
+	/*
+	 * The packets still buffered belong to the previous stream, so
+	 * does the counter of the last packet seen.
+	 */
+	obci_rx_reset(dev);
 
 	ret = obci_text_cmd(dev, cmd, NULL, 0);
 	if (ret < 0)
@@ -127,11 +186,24 @@ int obci_set_streaming(struct obci_dev *dev, bool streaming)
 	return 0;
 }
 
+/**
+ * obci_set_time_stamp() - Switch the time stamps in the data packets.
+ */
+int obci_set_time_stamp(struct obci_dev *dev, bool on)
+{
+	char cmd[] = {on ? OPENBCI_TIME_SET : OPENBCI_TIME_STOP, 0};
+	char buf[64] = {0};
+
+	return obci_text_query(dev, cmd, buf, sizeof(buf), OPENBCI_REPLY_TIMEOUT);
+}
+
 /**
  * obci_enable_channel() - Enable the channel given.
  */
 int obci_enable_channel(struct obci_dev *dev, int chan)
 {
+	dev->chan_cfg[chan - 1].powerdown = false;
+
 	return obci_text_cmd(dev, OPENBCI_CHANNEL_ON(chan), NULL, 0);
 }
 
@@ -140,6 +212,8 @@ int obci_enable_channel(struct obci_dev *dev, int chan)
  */
 int obci_disable_channel(struct obci_dev *dev, int chan)
 {
+	dev->chan_cfg[chan - 1].powerdown = true;
+
 	return obci_text_cmd(dev, OPENBCI_CHANNEL_OFF(chan), NULL, 0);
 }
 
@@ -152,6 +226,11 @@ int obci_disable_channel(struct obci_dev *dev, int chan)
 int obci_enable_test_signal(struct obci_dev *dev, char mode)
 {
 	char tmp[64] = {0};
+	int i;
+
+	/* The test signal switches the input of all the channels. */
+	for (i = 0; i < OPENBCI_MAX_CHANS; ++i)
+		dev->chan_cfg[i].input_type = OPENBCI_CHANNEL_CMD_ADC_TestSig;
 
 	if (!dev->is_streaming)
 		return obci_text_cmd(dev, mode, tmp, sizeof(tmp));
@@ -160,12 +239,14 @@ int obci_enable_test_signal(struct obci_dev *dev, char mode)
 }
 
 /**
- * obci_set_channel_config() - Set configuration for a single input.
+ * obci_add_channel_config() - Queue the configuration of a single input.
+ *
+ * Nothing is queued if the board already has this configuration.
  */
-int obci_set_channel_config(struct obci_dev *dev, int chan, bool powerdown,
-		int gain, char input_type, bool bias, bool srb2, bool srb1)
+void obci_add_channel_config(struct obci_dev *dev, struct obci_cmdbuf *cb, int chan,
+		bool powerdown, int gain, char input_type, bool bias, bool srb2, bool srb1)
 {
-	char tmp[64] = {0};
+	struct obci_chan_cfg *cfg = &dev->chan_cfg[chan];
 	char cmds[] = {
 		OPENBCI_CHANNEL_CMD_SET,
 		OPENBCI_CHANNEL_CMD_CHANNEL(chan + 1),
@@ -176,65 +257,125 @@ int obci_set_channel_config(struct obci_dev *dev, int chan, bool powerdown,
 		srb2 ? OPENBCI_CHANNEL_CMD_SRB2_CONNECT : OPENBCI_CHANNEL_CMD_SRB2_DISCONNECT,
 		srb1 ? OPENBCI_CHANNEL_CMD_SRB1_CONNECT : OPENBCI_CHANNEL_CMD_SRB1_DISCONNECT,
 		OPENBCI_CHANNEL_CMD_LATCH,
-		0,
 	};
 
-	if (!dev->is_streaming)
-		return obci_text_cmds(dev, cmds, tmp, sizeof(tmp));
-	else
-		return obci_text_cmds(dev, cmds, NULL, 0);
+	if (dev->chan_cfg_valid && cfg->powerdown == powerdown
+	    && cfg->gain == OPENBCI_CHANNEL_CMD_GAIN(gain) && cfg->input_type == input_type
+	    && cfg->bias == bias && cfg->srb2 == srb2 && cfg->srb1 == srb1)
+		return;
+
+	cfg->powerdown = powerdown;
+	cfg->gain = OPENBCI_CHANNEL_CMD_GAIN(gain);
+	cfg->input_type = input_type;
+	cfg->bias = bias;
+	cfg->srb2 = srb2;
+	cfg->srb1 = srb1;
+
+	obci_cmd_add(cb, cmds, sizeof(cmds));
 }
 
 /**
- * obci_set_channel_config_all() - Set channel config for all channels at the same time.
+ * obci_add_channel_config_all() - Queue the same configuration for all inputs.
  */
-int obci_set_channel_config_all(struct obci_dev *dev, bool powerdown, int gain,
-		char input_type, bool bias, bool srb2, bool srb1)
+void obci_add_channel_config_all(struct obci_dev *dev, struct obci_cmdbuf *cb, bool powerdown,
+		int gain, char input_type, bool bias, bool srb2, bool srb1)
 {
-	int ret, i;
+	int i;
 
-	for (i = 0; i < dev->edev.channel_count; ++i) {
-		ret = obci_set_channel_config(dev, i, powerdown, gain, input_type, bias, srb2, srb1);
-		if (ret < 0)
-			return ret;
-	}
-
-	return 0;
+	for (i = 0; i < dev->eeg_chans; ++i)
+		obci_add_channel_config(dev, cb, i, powerdown, gain, input_type, bias, srb2, srb1);
 }
 
 /**
- * obci_restore_defaults() - Set all channels to the default settings.
+ * obci_add_restore_defaults() - Queue the reset of all channels to the default settings.
  */
-int obci_restore_defaults(struct obci_dev *dev)
+void obci_add_restore_defaults(struct obci_dev *dev, struct obci_cmdbuf *cb)
 {
-	char tmp[64] = {0};
 	char cmd = OPENBCI_CHANNEL_DEFAULT_ALL_SET;
 
-	if (!dev->is_streaming)
-		return obci_text_cmd(dev, cmd, tmp, sizeof(tmp));
-	else
-		return obci_text_cmd(dev, cmd, NULL, 0);
+	obci_cmd_add(cb, &cmd, 1);
+
+	obci_chan_cfg_defaults(dev);
 }
 
 /**
- * obci_set_leadoff_impedance() - Set impeadence test signal on a given channel.
+ * obci_add_leadoff_impedance() - Queue the impedance test signal setting of a channel.
+ *
+ * Nothing is queued if the board already has this setting.
  */
-int obci_set_leadoff_impedance(struct obci_dev *dev, int chan, bool pchan, bool nchan)
+void obci_add_leadoff_impedance(struct obci_dev *dev, struct obci_cmdbuf *cb, int chan,
+		bool pchan, bool nchan)
 {
-	char tmp[64] = {0};
+	struct obci_chan_cfg *cfg = &dev->chan_cfg[chan];
 	char cmds[] = {
 		OPENBCI_CHANNEL_IMPEDANCE_SET,
 		OPENBCI_CHANNEL_CMD_CHANNEL(chan + 1),
 		pchan ? OPENBCI_CHANNEL_IMPEDANCE_TEST_SIGNAL_APPLIED :OPENBCI_CHANNEL_IMPEDANCE_TEST_SIGNAL_APPLIED_NOT,
 		nchan ? OPENBCI_CHANNEL_IMPEDANCE_TEST_SIGNAL_APPLIED :OPENBCI_CHANNEL_IMPEDANCE_TEST_SIGNAL_APPLIED_NOT,
 		OPENBCI_CHANNEL_IMPEDANCE_LATCH,
-		0,
 	};
 
-	if (!dev->is_streaming)
-		return obci_text_cmds(dev, cmds, tmp, sizeof(tmp));
-	else
-		return obci_text_cmds(dev, cmds, NULL, 0);
+	if (dev->chan_cfg_valid && cfg->leadoff_p == pchan && cfg->leadoff_n == nchan)
+		return;
+
+	cfg->leadoff_p = pchan;
+	cfg->leadoff_n = nchan;
+
+	obci_cmd_add(cb, cmds, sizeof(cmds));
+}
+
+/**
+ * obci_set_channel_config() - Set configuration for a single input.
+ */
+int obci_set_channel_config(struct obci_dev *dev, int chan, bool powerdown,
+		int gain, char input_type, bool bias, bool srb2, bool srb1)
+{
+	struct obci_cmdbuf cb;
+
+	obci_cmd_init(&cb);
+	obci_add_channel_config(dev, &cb, chan, powerdown, gain, input_type, bias, srb2, srb1);
+
+	return obci_cmd_flush(dev, &cb);
+}
+
+/**
+ * obci_set_channel_config_all() - Set channel config for all channels at the same time.
+ */
+int obci_set_channel_config_all(struct obci_dev *dev, bool powerdown, int gain,
+		char input_type, bool bias, bool srb2, bool srb1)
+{
+	struct obci_cmdbuf cb;
+
+	obci_cmd_init(&cb);
+	obci_add_channel_config_all(dev, &cb, powerdown, gain, input_type, bias, srb2, srb1);
+
+	return obci_cmd_flush(dev, &cb);
+}
+
+/**
+ * obci_restore_defaults() - Set all channels to the default settings.
+ */
+int obci_restore_defaults(struct obci_dev *dev)
+{
+	struct obci_cmdbuf cb;
+
+	obci_cmd_init(&cb);
+	obci_add_restore_defaults(dev, &cb);
+
+	return obci_cmd_flush(dev, &cb);
+}
+
+/**
+ * obci_set_leadoff_impedance() - Set impeadence test signal on a given channel.
+ */
+int obci_set_leadoff_impedance(struct obci_dev *dev, int chan, bool pchan, bool nchan)
+{
+	struct obci_cmdbuf cb;
+
+	obci_cmd_init(&cb);
+	obci_add_leadoff_impedance(dev, &cb, chan, pchan, nchan);
+
+	return obci_cmd_flush(dev, &cb);
 }
 
 /**
@@ -242,14 +383,12 @@ int obci_set_leadoff_impedance(struct obci_dev *dev, int chan, bool pchan, bool
  */
 int obci_set_leadoff_impedance_all(struct obci_dev *dev, bool pchan, bool nchan)
 {
-	int ret, i;
+	struct obci_cmdbuf cb;
+	int i;
 
-	for (i = 0; i < dev->edev.channel_count; ++i) {
-		ret = obci_set_leadoff_impedance(dev, i, pchan, nchan);
-		if (ret < 0)
-			return ret;
-	}
+	obci_cmd_init(&cb);
+	for (i = 0; i < dev->eeg_chans; ++i)
+		obci_add_leadoff_impedance(dev, &cb, i, pchan, nchan);
 
-	return 0;
+	return obci_cmd_flush(dev, &cb);
 }
-
@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+/*
+ * convert.c - Conversion of the ADS1299 24-bit samples.
+ *
+ * The ADC sends each channel as a 24-bit big-endian two's complement
+ * value. The packets are converted in batches, with SIMD kernels where
+ * the CPU supports them and a scalar fallback otherwise.
+ */
+
+#include <stdint.h>
+
+#include "openbci.h"
+#include "packets.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define OBCI_CONVERT_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * obci_i24() - Convert a single 24-bit big-endian value.
+ */
+static inline int32_t obci_i24(const uint8_t *bytes)
+{
+	/* Place the value in the top bytes, the shift extends the sign. */
+	return (int32_t)((uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16
+			 | (uint32_t)bytes[2] << 8) >> 8;
+}
+
+static void obci_convert_scalar(const struct openbci_data *pkts, int cnt, int32_t *codes)
+{
+	int i, j;
+
+	for (i = 0; i < cnt; ++i)
+		for (j = 0; j < OPENBCI_ADS_CHANS_PER_BOARD; ++j)
+			*codes++ = obci_i24(&pkts[i].data[j * 3]);
+}
+
+static void obci_convert_scaled_scalar(const struct openbci_data *pkts, int cnt,
+				       float scale, float *out)
+{
+	int i, j;
+
+	for (i = 0; i < cnt; ++i)
+		for (j = 0; j < OPENBCI_ADS_CHANS_PER_BOARD; ++j)
+			*out++ = obci_i24(&pkts[i].data[j * 3]) * scale;
+}
+
+#ifdef OBCI_CONVERT_X86
+
+/*
+ * The 16-byte loads at offset 12 read 4 bytes past the sample data,
+ * these are the aux bytes of the same packet, so it's always safe.
+ */
+_Static_assert(sizeof(((struct openbci_data *)0)->data) + sizeof(((struct openbci_data *)0)->aux) >= 28,
+	       "The packet must fit the vector loads.");
+
+/* Move the three bytes of each value to the top of a 32-bit lane, swapped. */
+#define OBCI_SHUFFLE_MASK \
+	-1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9
+
+__attribute__((target("ssse3")))
+static inline void obci_load_ssse3(const struct openbci_data *pkt, __m128i *lo, __m128i *hi)
+{
+	const __m128i mask = _mm_setr_epi8(OBCI_SHUFFLE_MASK);
+
+	*lo = _mm_loadu_si128((const __m128i *)&pkt->data[0]);
+	*hi = _mm_loadu_si128((const __m128i *)&pkt->data[12]);
+	*lo = _mm_srai_epi32(_mm_shuffle_epi8(*lo, mask), 8);
+	*hi = _mm_srai_epi32(_mm_shuffle_epi8(*hi, mask), 8);
+}
+
+__attribute__((target("ssse3")))
+static void obci_convert_ssse3(const struct openbci_data *pkts, int cnt, int32_t *codes)
+{
+	__m128i lo, hi;
+	int i;
+
+	for (i = 0; i < cnt; ++i, codes += OPENBCI_ADS_CHANS_PER_BOARD) {
+		obci_load_ssse3(&pkts[i], &lo, &hi);
+		_mm_storeu_si128((__m128i *)&codes[0], lo);
+		_mm_storeu_si128((__m128i *)&codes[4], hi);
+	}
+}
+
+__attribute__((target("ssse3")))
+static void obci_convert_scaled_ssse3(const struct openbci_data *pkts, int cnt,
+				      float scale, float *out)
+{
+	const __m128 vscale = _mm_set1_ps(scale);
+	__m128i lo, hi;
+	int i;
+
+	for (i = 0; i < cnt; ++i, out += OPENBCI_ADS_CHANS_PER_BOARD) {
+		obci_load_ssse3(&pkts[i], &lo, &hi);
+		_mm_storeu_ps(&out[0], _mm_mul_ps(_mm_cvtepi32_ps(lo), vscale));
+		_mm_storeu_ps(&out[4], _mm_mul_ps(_mm_cvtepi32_ps(hi), vscale));
+	}
+}
+
+__attribute__((target("avx2")))
+static inline __m256i obci_load_avx2(const struct openbci_data *pkt)
+{
+	const __m256i mask = _mm256_setr_epi8(OBCI_SHUFFLE_MASK, OBCI_SHUFFLE_MASK);
+	__m256i v;
+
+	v = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)&pkt->data[0]));
+	v = _mm256_inserti128_si256(v, _mm_loadu_si128((const __m128i *)&pkt->data[12]), 1);
+
+	return _mm256_srai_epi32(_mm256_shuffle_epi8(v, mask), 8);
+}
+
+__attribute__((target("avx2")))
+static void obci_convert_avx2(const struct openbci_data *pkts, int cnt, int32_t *codes)
+{
+	int i;
+
+	for (i = 0; i < cnt; ++i, codes += OPENBCI_ADS_CHANS_PER_BOARD)
+		_mm256_storeu_si256((__m256i *)codes, obci_load_avx2(&pkts[i]));
+}
+
+__attribute__((target("avx2")))
+static void obci_convert_scaled_avx2(const struct openbci_data *pkts, int cnt,
+				     float scale, float *out)
+{
+	const __m256 vscale = _mm256_set1_ps(scale);
+	int i;
+
+	for (i = 0; i < cnt; ++i, out += OPENBCI_ADS_CHANS_PER_BOARD)
+		_mm256_storeu_ps(out, _mm256_mul_ps(_mm256_cvtepi32_ps(obci_load_avx2(&pkts[i])),
+						    vscale));
+}
+
+#endif /* OBCI_CONVERT_X86 */
+
+/**
+ * obci_convert() - Convert the channel data of packets to ADC codes.
+ * @pkts:  The packets to convert.
+ * @cnt:   Amount of packets.
+ * @codes: Output buffer for (@cnt * OPENBCI_ADS_CHANS_PER_BOARD) codes.
+ */
+void obci_convert(const struct openbci_data *pkts, int cnt, int32_t *codes)
+{
+#ifdef OBCI_CONVERT_X86
+	if (__builtin_cpu_supports("avx2"))
+		obci_convert_avx2(pkts, cnt, codes);
+	else if (__builtin_cpu_supports("ssse3"))
+		obci_convert_ssse3(pkts, cnt, codes);
+	else
+#endif
+		obci_convert_scalar(pkts, cnt, codes);
+}
+
+/**
+ * obci_convert_scaled() - Convert the channel data of packets to values.
+ * @pkts:  The packets to convert.
+ * @cnt:   Amount of packets.
+ * @scale: Value of a single ADC code, see OPENBCI_SCALE().
+ * @out:   Output buffer for (@cnt * OPENBCI_ADS_CHANS_PER_BOARD) values.
+ */
+void obci_convert_scaled(const struct openbci_data *pkts, int cnt, float scale, float *out)
+{
+#ifdef OBCI_CONVERT_X86
+	if (__builtin_cpu_supports("avx2"))
+		obci_convert_scaled_avx2(pkts, cnt, scale, out);
+	else if (__builtin_cpu_supports("ssse3"))
+		obci_convert_scaled_ssse3(pkts, cnt, scale, out);
+	else
+#endif
+		obci_convert_scaled_scalar(pkts, cnt, scale, out);
+}
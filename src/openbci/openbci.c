@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 
 #include <errno.h>
 #include <unistd.h>
@@ -21,79 +22,276 @@
 #include "packets.h"
 #include "OpenBCI_32bit_Library_Definitions.h"
 
-static int i24to32(uint8_t *bytes) {
-	int ret = (bytes[0] << 16) | (bytes[1] << 8) | bytes[2];
+static int32_t be16(const uint8_t *bytes)
+{
+	return (int16_t)(bytes[0] << 8 | bytes[1]);
+}
 
-	if (ret & 0x00800000)
-		ret |= 0xFF000000;
-	else
-		ret &= 0x00FFFFFF;
+static int32_t be32(const uint8_t *bytes)
+{
+	return (int32_t)((uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16
+			 | (uint32_t)bytes[2] << 8 | bytes[3]);
+}
 
-	return ret;
+/**
+ * obci_decode_aux() - Decode the aux bytes according to the stop byte.
+ * @codes: Buffer for the aux_chans codes.
+ *
+ * The time stamped packets hold a single aux value followed by the
+ * time stamp. Without the time stamps enabled, these would only be
+ * sent by a board configured behind our back, their values are zeroed.
+ */
+static void obci_decode_aux(const struct obci_dev *dev, const struct openbci_data *data,
+			    int32_t *codes)
+{
+	const uint8_t *aux = data->aux;
+	bool stamped;
+	int i = 0;
+
+	stamped = data->stop >= OPENBCI_STOP_TIME_SET_ACCEL && data->stop <= OPENBCI_STOP_TIME_RAW;
+
+	if (!dev->timestamp) {
+		for (i = 0; i < OPENBCI_AUX_CHANS; ++i)
+			codes[i] = stamped ? 0 : be16(&aux[2 * i]);
+		return;
+	}
+
+	if (dev->aux)
+		codes[i++] = be16(&aux[0]);
+
+	codes[i] = stamped ? be32(&aux[2]) : 0;
 }
 
-static int obci_read_sample(struct obci_dev *dev, float *samples)
+/**
+ * obci_lost_frames() - Count the frames missing between two packets.
+ * @prev: Extended counter of the previous packet.
+ * @next: Extended counter of the received packet, past @prev + 1.
+ *
+ * With the Daisy subboard a frame is lost as soon as any of its halves
+ * is, the packet p belongs to the frame (p + 1) / 2. A Cyton half left
+ * behind by @prev and a Daisy half without its Cyton one in @next are
+ * lost frames as well.
+ */
+static unsigned long long obci_lost_frames(const struct obci_dev *dev,
+					   unsigned long long prev, unsigned long long next)
 {
-	struct openbci_data data = {0};
-	float tmp[OPENBCI_ADS_CHANS_PER_BOARD];
-	int i, ret;
+	unsigned long long lost;
 
-	ret = obci_read_data_pkt(dev, &data);
-	if (ret < 0)
-		return ret;
+	if (dev->eeg_chans == 8)
+		return next - prev - 1;
 
-	for (i = 0; i < OPENBCI_ADS_CHANS_PER_BOARD; ++i)
-		tmp[i] = (float)i24to32(&data.data[i*3]) * (4.5 / (2<<22 - 1)) / dev->gain / 2;
+	lost = (next + 1) / 2 - (prev + 1) / 2 - 1;
+	lost += prev & 1;
+	lost += !(next & 1);
 
-	if (dev->edev.channel_count == 8) {
-		memcpy(samples, tmp, sizeof(tmp));
-	} else if (data.seq & 1) {
-		/* board */
-		memcpy(samples, tmp, sizeof(tmp));
-		memcpy(&samples[OPENBCI_ADS_CHANS_PER_BOARD], dev->scratch, sizeof(dev->scratch));
-	} else {
-		/* daisy */
-		memcpy(&samples[OPENBCI_ADS_CHANS_PER_BOARD], tmp, sizeof(tmp));
-		memcpy(samples, dev->scratch, sizeof(dev->scratch));
+	return lost;
+}
+
+/**
+ * obci_decode_sample() - Assemble the ADC codes of a single sample.
+ * @data:  The received packet.
+ * @tmp:   The codes converted from @data.
+ * @codes: Buffer that fits source_count codes.
+ *
+ * With the Daisy subboard a frame is made of a Cyton and a Daisy
+ * packet with consecutive sequence numbers. A half without its pair
+ * is dropped, so every frame has all the channels from the same
+ * sample. The frame sequence number is the packet one halved, so
+ * the lost frames show up as gaps in it. The aux channels are taken
+ * from the Cyton packet, which carries the accelerometer. The frames
+ * missing in the packet counter are accounted as lost.
+ *
+ * Return: Whether @codes holds a complete frame.
+ */
+static bool obci_decode_sample(struct obci_dev *dev, const struct openbci_data *data,
+			       const int32_t *tmp, int32_t *codes)
+{
+	size_t len = sizeof(*tmp) * OPENBCI_ADS_CHANS_PER_BOARD;
+	unsigned long long prev = dev->seq;
+
+	dev->seq += (uint8_t)(data->seq - dev->last_seq);
+	dev->last_seq = data->seq;
+
+	if (dev->have_seq && dev->seq - prev > 1)
+		med_eeg_lost(&dev->edev, obci_lost_frames(dev, prev, dev->seq));
+	dev->have_seq = true;
+
+	if (dev->eeg_chans == 8) {
+		memcpy(codes, tmp, len);
+		if (dev->aux_chans)
+			obci_decode_aux(dev, data, &codes[8]);
+		dev->frame_seq = dev->seq;
+		return true;
 	}
 
-	memcpy(dev->scratch, tmp, sizeof(tmp));
+	if (data->seq & 1) {
+		if (dev->have_board)
+			med_dbg(&dev->edev, "Unpaired board packet %u", dev->board_seq);
 
-	return 0;
+		memcpy(dev->scratch, tmp, len);
+		if (dev->aux_chans)
+			obci_decode_aux(dev, data, dev->scratch_aux);
+		dev->board_seq = data->seq;
+		dev->have_board = true;
+		return false;
+	}
+
+	if (!dev->have_board || !obci_is_pair(dev->board_seq, data->seq)) {
+		med_dbg(&dev->edev, "Unpaired daisy packet %u", data->seq);
+		dev->have_board = false;
+		return false;
+	}
+
+	memcpy(codes, dev->scratch, sizeof(dev->scratch));
+	memcpy(&codes[OPENBCI_ADS_CHANS_PER_BOARD], tmp, len);
+	if (dev->aux_chans)
+		memcpy(&codes[16], dev->scratch_aux, sizeof(dev->scratch_aux));
+	dev->have_board = false;
+	dev->frame_seq = dev->seq / 2;
+
+	return true;
 }
 
-static int openbci_sample(struct med_eeg *edev)
+/**
+ * obci_queue_samples() - Decode the packets into the sample queue.
+ * @cnt: Amount of packets, at most OPENBCI_BATCH.
+ *
+ * Return: Amount of samples queued.
+ */
+static int obci_queue_samples(struct obci_dev *dev, const struct openbci_data *pkts, int cnt)
+{
+	int32_t tmp[OPENBCI_BATCH * OPENBCI_ADS_CHANS_PER_BOARD];
+	int32_t codes[2 * OPENBCI_ADS_CHANS_PER_BOARD + OPENBCI_AUX_CHANS];
+	struct med_eeg *edev = &dev->edev;
+	int i, j, queued = 0;
+	float *next;
+
+	obci_convert(pkts, cnt, tmp);
+
+	for (i = 0; i < cnt; ++i) {
+		if (!obci_decode_sample(dev, &pkts[i], &tmp[i * OPENBCI_ADS_CHANS_PER_BOARD], codes))
+			continue;
+
+		next = med_eeg_alloc_sample(edev);
+
+		for (j = 0; j < edev->channel_count; ++j)
+			med_eeg_put_code(edev, next, j, codes[med_eeg_chan(edev, j)]);
+
+		med_eeg_add_sample(edev, dev->frame_seq);
+		queued++;
+	}
+
+	return queued;
+}
+
+static int openbci_sample_batch(struct med_eeg *edev, int max)
 {
 	struct obci_dev *dev = container_of(edev, struct obci_dev, edev);
-	struct med_sample *next = med_eeg_alloc_sample(edev);
-	int ret;
+	struct openbci_data pkts[OPENBCI_BATCH];
+	int ret, n, cnt = 0;
+	bool filled = false;
+
+	while (cnt < max) {
+		n = 0;
+		while (n < OPENBCI_BATCH && cnt + n < max && obci_rx_pkt(dev, &pkts[n]))
+			n++;
+
+		if (n) {
+			cnt += obci_queue_samples(dev, pkts, n);
+			continue;
+		}
+
+		/*
+		 * Only wait once, then take what has arrived. A partial
+		 * packet is left for the next call, so the driver never
+		 * blocks once the caller has seen the fd readable.
+		 */
+		if (cnt || filled) {
+			ret = s_poll(dev->fd, 0);
+			if (ret < 0)
+				return ret;
+			if (!ret)
+				break;
+		}
+
+		ret = obci_rx_fill(dev);
+		if (ret < 0)
+			return ret;
 
-	ret = obci_read_sample(dev, next->data);
-	if (ret < 0) {
-		free(next);
-		return ret;
+		filled = true;
 	}
 
-	med_eeg_add_sample(edev, next);
+	return cnt;
+}
 
-	return 1;
+static int openbci_sample(struct med_eeg *edev)
+{
+	return openbci_sample_batch(edev, 1);
+}
+
+static int openbci_get_fd(struct med_eeg *edev)
+{
+	struct obci_dev *dev = container_of(edev, struct obci_dev, edev);
+
+	return dev->fd;
+}
+
+static bool openbci_pending(struct med_eeg *edev)
+{
+	struct obci_dev *dev = container_of(edev, struct obci_dev, edev);
+
+	return obci_rx_pending(dev);
 }
 
 static int openbci_get_impedance(struct med_eeg *edev, float *samples)
 {
 	struct obci_dev *dev = container_of(edev, struct obci_dev, edev);
-	float *buf = malloc(sizeof(float) * edev->channel_count * dev->impedance_samples);
-	int i, ret;
+	/* A frame is a Cyton and a Daisy packet with the subboard. */
+	int i = 0, ret, per = dev->eeg_chans == 8 ? 1 : 2;
+	int cnt = dev->impedance_samples * per;
+	struct openbci_data *pkts = malloc(sizeof(*pkts) * cnt);
+	float *buf = malloc(sizeof(*buf) * OPENBCI_ADS_CHANS_PER_BOARD * cnt);
+
+	if (!pkts || !buf) {
+		ret = -ENOMEM;
+		goto error;
+	}
 
-	for (i = 0; i < dev->impedance_samples; i++) {
-		ret = obci_read_sample(dev, &buf[edev->channel_count * i]);
+	while (i < cnt) {
+		ret = obci_read_data_pkt(dev, &pkts[i]);
 		if (ret < 0)
 			goto error;
+
+		/* Keep only the complete pairs, Cyton at even and Daisy at odd index. */
+		if (per == 1)
+			i++;
+		else if (!(i & 1))
+			i += pkts[i].seq & 1;
+		else if (obci_is_pair(pkts[i - 1].seq, pkts[i].seq))
+			i++;
+		else if (pkts[i].seq & 1)
+			pkts[i - 1] = pkts[i];
+		else
+			i--;
 	}
 
-	ret = obci_calculate_leadoff_impedane(buf, samples, dev->impedance_samples, edev->channel_count);
+	/*
+	 * All the channels share the same scale. The pairs are converted
+	 * next to each other, so they form the 16 channel frames as is.
+	 */
+	obci_convert_scaled(pkts, cnt, OPENBCI_SCALE(dev->gain), buf);
+
+	ret = obci_calculate_leadoff_impedane(buf, samples, dev->impedance_samples, dev->eeg_chans);
+	if (ret < 0)
+		goto error;
+
+	for (i = dev->eeg_chans; i < edev->source_count; ++i)
+		samples[i] = NAN;
+
+	ret = edev->source_count;
 
 error:
+	free(pkts);
 	free(buf);
 	return ret;
 }
@@ -101,7 +299,7 @@ error:
 static int openbci_set_mode(struct med_eeg *edev, enum med_eeg_mode mode)
 {
 	struct obci_dev *dev = container_of(edev, struct obci_dev, edev);
-	char buf[128];
+	struct obci_cmdbuf cb;
 	int ret;
 
 	switch (mode) {
@@ -109,24 +307,25 @@ static int openbci_set_mode(struct med_eeg *edev, enum med_eeg_mode mode)
 		return obci_set_streaming(dev, false);
 
 	case MED_EEG_SAMPLING:
-		ret = obci_restore_defaults(dev);
-		if (ret < 0)
-			return ret;
-
-		ret = obci_set_channel_config_all(dev, false, dev->gain, OPENBCI_CHANNEL_CMD_ADC_Normal, false, true, false);
+		/* Only the settings that differ from the board state go out, in a single write. */
+		obci_cmd_init(&cb);
+		if (!dev->chan_cfg_valid)
+			obci_add_restore_defaults(dev, &cb);
+		obci_add_channel_config_all(dev, &cb, false, dev->gain, OPENBCI_CHANNEL_CMD_ADC_Normal, false, true, false);
+		obci_add_leadoff_impedance(dev, &cb, 0, false, true);
+
+		ret = obci_cmd_flush(dev, &cb);
 		if (ret < 0)
 			return ret;
 
-		ret = obci_set_leadoff_impedance(dev, 0, false, true);
-
 		return obci_set_streaming(dev, true);
 
 	case MED_EEG_IMPEDANCE:
-		ret = obci_set_channel_config(dev, 0, false, dev->gain, OPENBCI_CHANNEL_CMD_ADC_Normal, true, true, false);
-		if (ret < 0)
-			return ret;
+		obci_cmd_init(&cb);
+		obci_add_channel_config(dev, &cb, 0, false, dev->gain, OPENBCI_CHANNEL_CMD_ADC_Normal, true, true, false);
+		obci_add_leadoff_impedance(dev, &cb, 0, false, true);
 
-		ret = obci_set_leadoff_impedance(dev, 0, false, true);
+		ret = obci_cmd_flush(dev, &cb);
 		if (ret < 0)
 			return ret;
 
@@ -156,6 +355,7 @@ static void openbci_destroy(struct med_eeg *edev)
 		free(edev->channel_labels[i]);
 
 	free(edev->channel_labels);
+	free(edev->scales);
 	free(dev);
 }
 
@@ -164,17 +364,29 @@ static int obci_init(struct obci_dev *dev)
 	unsigned char tmp;
 	int ret; 
 
+	if (dev->attach) {
+		ret = obci_attach(dev);
+		if (ret >= 0)
+			return obci_set_time_stamp(dev, dev->timestamp);
+
+		med_info(&dev->edev, "Board did not answer, resetting it");
+	}
+
 	ret = obci_reset(dev);
 	if (ret < 0)
 		return ret;
 
-	ret = obci_get_version(dev);
+	ret = obci_get_version(dev, -1);
 	if (ret < 0) {
 		med_err(&dev->edev, "Failed to read firmware version: %d", ret);
 		med_err(&dev->edev, "Is the device firmware up to date?");
 		return ret;
 	}
 
+	/* The time stamps are off after the reset. */
+	if (dev->timestamp)
+		return obci_set_time_stamp(dev, true);
+
 	return 0;
 	/*
 	 * FIXME: Firmware seems to be borked so touching the subboard config
@@ -199,7 +411,7 @@ static int obci_init(struct obci_dev *dev)
 int openbci_create(struct med_eeg **edev, struct med_kv *kv)
 {
 	struct obci_dev *dev = malloc(sizeof(*dev));
-	const char *key, *val;
+	const char *key, *val, *aux = NULL;
 	int ret, i, chan_cnt = 0;
 
 	memset(dev, 0, sizeof(*dev));
@@ -223,6 +435,19 @@ int openbci_create(struct med_eeg **edev, struct med_kv *kv)
 			dev->impedance_samples = atoi(val);
 		else if (!strcmp("gain", key))
 			dev->gain = atoi(val);
+		else if (!strcmp("aux", key))
+			aux = val;
+		else if (!strcmp("attach", key))
+			dev->attach = atoi(val);
+		else if (!strcmp("timestamp", key))
+			dev->timestamp = atoi(val);
+	}
+
+	if (aux && strcmp(aux, "accel") && strcmp(aux, "raw")) {
+		med_err(*edev, "Unknown aux mode %s", aux);
+		free(dev->port);
+		free(dev);
+		return -EINVAL;
 	}
 
 	dev->gain = OPENBCI_CLAMP_GAIN(dev->gain);
@@ -237,18 +462,53 @@ int openbci_create(struct med_eeg **edev, struct med_kv *kv)
 	if (ret < 0)
 		return ret;
 
-	chan_cnt = (*edev)->channel_count;
+	dev->eeg_chans = (*edev)->channel_count;
+	dev->aux = aux;
+
+	/* The time stamped packets carry a single aux value. */
+	if (dev->timestamp)
+		dev->aux_chans = (aux ? 1 : 0) + 1;
+	else
+		dev->aux_chans = aux ? OPENBCI_AUX_CHANS : 0;
+
+	chan_cnt = dev->eeg_chans + dev->aux_chans;
+	(*edev)->channel_count = chan_cnt;
 
 	(*edev)->channel_labels = malloc(sizeof(char**) * chan_cnt);
+	(*edev)->scales = malloc(sizeof(*(*edev)->scales) * chan_cnt);
 
-	for (i = 0; i < chan_cnt; ++i) {
+	for (i = 0; i < dev->eeg_chans; ++i) {
 		(*edev)->channel_labels[i] = malloc(sizeof(char) * 8);
 		snprintf((*edev)->channel_labels[i], 8, "eeg%d", i);
+		(*edev)->scales[i].gain = OPENBCI_SCALE(dev->gain);
+		(*edev)->scales[i].offset = 0;
+	}
+
+	for (i = dev->eeg_chans; i < chan_cnt; ++i) {
+		(*edev)->channel_labels[i] = malloc(sizeof(char) * 8);
+		if (dev->timestamp && i == chan_cnt - 1) {
+			snprintf((*edev)->channel_labels[i], 8, "time");
+			(*edev)->scales[i].gain = 1;
+		} else if (!strcmp(aux, "accel")) {
+			/* A single value rotates through the axes. */
+			if (dev->timestamp)
+				snprintf((*edev)->channel_labels[i], 8, "acc");
+			else
+				snprintf((*edev)->channel_labels[i], 8, "acc%c", 'X' + i - dev->eeg_chans);
+			(*edev)->scales[i].gain = OPENBCI_ACCEL_SCALE;
+		} else {
+			snprintf((*edev)->channel_labels[i], 8, "aux%d", i - dev->eeg_chans);
+			(*edev)->scales[i].gain = 1;
+		}
+		(*edev)->scales[i].offset = 0;
 	}
 
 	(*edev)->sample         = openbci_sample;
+	(*edev)->sample_batch   = openbci_sample_batch;
 	(*edev)->get_impedance  = openbci_get_impedance;
 	(*edev)->set_mode       = openbci_set_mode;
+	(*edev)->get_fd         = openbci_get_fd;
+	(*edev)->pending        = openbci_pending;
 	(*edev)->destroy        = openbci_destroy;
 	
 	return 0;
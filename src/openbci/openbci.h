@@ -3,11 +3,86 @@
 #define OPENBCI_H
 
 #include <stdbool.h>
+#include <string.h>
+#include <assert.h>
 
 #include <med/eeg_priv.h>
 
 #include "packets.h"
 
+/* Value of a single ADC code in volts at the given gain. */
+#define OPENBCI_SCALE(gain) (4.5 / ((1 << 23) - 1) / (gain))
+
+/* Amount of packets converted at once. */
+#define OPENBCI_BATCH 32
+
+/* Size of the receive buffer, fits many packets to read them at once. */
+#define OPENBCI_RX_SIZE (OPENBCI_PACKET_SIZE * 64)
+
+/* Channels of the Cyton with the Daisy attached. */
+#define OPENBCI_MAX_CHANS (2 * OPENBCI_ADS_CHANS_PER_BOARD)
+
+/**
+ * struct obci_chan_cfg - Configuration of a single input as last sent to the board.
+ * @powerdown:  Whether the input is powered down.
+ * @gain:       PGA gain, one of the OPENBCI_CHANNEL_CMD_GAIN_* codes.
+ * @input_type: Input mux, one of the OPENBCI_CHANNEL_CMD_ADC_* codes.
+ * @bias:       Whether the input is included in the bias derivation.
+ * @srb2:       Whether the input is connected to SRB2.
+ * @srb1:       Whether the input is connected to SRB1.
+ * @leadoff_p:  Whether the lead-off test signal is applied to the P input.
+ * @leadoff_n:  Whether the lead-off test signal is applied to the N input.
+ */
+struct obci_chan_cfg {
+	bool powerdown;
+	char gain;
+	char input_type;
+	bool bias;
+	bool srb2;
+	bool srb1;
+	bool leadoff_p;
+	bool leadoff_n;
+};
+
+/* How long a running board takes to answer the version query, in ms. */
+#define OPENBCI_ATTACH_TIMEOUT 100
+
+/* How long the board may take to answer a command, in ms. */
+#define OPENBCI_REPLY_TIMEOUT 1000
+
+/* Size of the command buffer, fits the config of all the channels. */
+#define OPENBCI_CMD_SIZE 512
+
+/**
+ * struct obci_cmdbuf - Commands to be sent at once.
+ * @buf:     The command bytes.
+ * @len:     Amount of bytes in @buf.
+ * @replies: Amount of commands that reply.
+ */
+struct obci_cmdbuf {
+	char buf[OPENBCI_CMD_SIZE];
+	size_t len;
+	int replies;
+};
+
+static inline void obci_cmd_init(struct obci_cmdbuf *cb)
+{
+	cb->len = 0;
+	cb->replies = 0;
+}
+
+/**
+ * obci_cmd_add() - Queue a command that replies.
+ */
+static inline void obci_cmd_add(struct obci_cmdbuf *cb, const char *cmd, size_t len)
+{
+	assert(cb->len + len <= sizeof(cb->buf));
+
+	memcpy(&cb->buf[cb->len], cmd, len);
+	cb->len += len;
+	cb->replies++;
+}
+
 struct obci_dev {
 
 	struct med_eeg edev;
@@ -18,26 +93,85 @@ struct obci_dev {
 
 	bool is_streaming;
 
+	/* Try to take over a running board without the soft reset. */
+	bool attach;
+
 	int impedance_samples;
 
 	int gain;
 
-	float scratch[OPENBCI_ADS_CHANS_PER_BOARD];
+	/* Amount of EEG channels, the aux ones follow them if enabled. */
+	int eeg_chans;
+	bool aux;
+	int aux_chans;
+
+	/* The board sends the time stamp, which replaces two aux values. */
+	bool timestamp;
+
+	/* The 8-bit packet counter extended to 64 bits. */
+	unsigned long long seq;
+	uint8_t last_seq;
+	bool have_seq;
+	unsigned long long frame_seq;
+
+	/* Cyton half of the 16 channel frame waiting for the Daisy half. */
+	int32_t scratch[OPENBCI_ADS_CHANS_PER_BOARD];
+	int32_t scratch_aux[OPENBCI_AUX_CHANS];
+	bool have_board;
+	uint8_t board_seq;
+
+	/* Receive buffer, the unparsed data is between rx_pos and rx_len. */
+	uint8_t rx[OPENBCI_RX_SIZE];
+	size_t rx_pos;
+	size_t rx_len;
+	unsigned int rx_skipped;
+
+	/*
+	 * Shadow of the board channel configuration, only the changes
+	 * are sent. Not valid until the board is reset to the defaults.
+	 */
+	struct obci_chan_cfg chan_cfg[OPENBCI_MAX_CHANS];
+	bool chan_cfg_valid;
 };
 
+/**
+ * obci_is_pair() - Whether two packets are the two halves of the same frame.
+ *
+ * With the Daisy subboard installed the odd packets carry the Cyton
+ * channels and the following even packets the Daisy channels.
+ */
+static inline bool obci_is_pair(uint8_t board_seq, uint8_t daisy_seq)
+{
+	return (board_seq & 1) && daisy_seq == (uint8_t)(board_seq + 1);
+}
+
 /* packets.c */
 
 int obci_text_cmd(struct obci_dev *dev, const char cmd, char *buf, size_t len);
 int obci_text_cmds(struct obci_dev *dev, const char *cmd, char *buf, size_t len);
+int obci_text_query(struct obci_dev *dev, const char *cmd, char *buf, size_t len, int timeout);
+int obci_rx_reply(struct obci_dev *dev, char *buf, size_t len, int timeout);
+int obci_cmd_flush(struct obci_dev *dev, struct obci_cmdbuf *cb);
+int obci_rx_pkt(struct obci_dev *dev, struct openbci_data *data);
+bool obci_rx_pending(struct obci_dev *dev);
+int obci_rx_fill(struct obci_dev *dev);
+void obci_rx_reset(struct obci_dev *dev);
 int obci_read_data_pkt(struct obci_dev *dev, struct openbci_data *data);
 
+/* convert.c */
+
+void obci_convert(const struct openbci_data *pkts, int cnt, int32_t *codes);
+void obci_convert_scaled(const struct openbci_data *pkts, int cnt, float scale, float *out);
+
 /* commands.c */
 
 int obci_reset(struct obci_dev *dev);
-int obci_get_version(struct obci_dev *dev);
+int obci_get_version(struct obci_dev *dev, int timeout);
+int obci_attach(struct obci_dev *dev);
 int obci_get_max_channels(struct obci_dev *dev);
 int obci_set_max_channels(struct obci_dev *dev, int channels);
 int obci_set_streaming(struct obci_dev *dev, bool streaming);
+int obci_set_time_stamp(struct obci_dev *dev, bool on);
 int obci_enable_channel(struct obci_dev *dev, int chan);
 int obci_disable_channel(struct obci_dev *dev, int chan);
 int obci_enable_test_signal(struct obci_dev *dev, char mode);
@@ -48,6 +182,13 @@ int obci_set_channel_config_all(struct obci_dev *dev, bool powerdown, int gain,
 int obci_restore_defaults(struct obci_dev *dev);
 int obci_set_leadoff_impedance(struct obci_dev *dev, int chan, bool pchan, bool nchan);
 int obci_set_leadoff_impedance_all(struct obci_dev *dev, bool pchan, bool nchan);
+void obci_add_channel_config(struct obci_dev *dev, struct obci_cmdbuf *cb, int chan,
+		bool powerdown, int gain, char input_type, bool bias, bool srb2, bool srb1);
+void obci_add_channel_config_all(struct obci_dev *dev, struct obci_cmdbuf *cb, bool powerdown,
+		int gain, char input_type, bool bias, bool srb2, bool srb1);
+void obci_add_restore_defaults(struct obci_dev *dev, struct obci_cmdbuf *cb);
+void obci_add_leadoff_impedance(struct obci_dev *dev, struct obci_cmdbuf *cb, int chan,
+		bool pchan, bool nchan);
 
 /* impedance.c */
 int obci_calculate_leadoff_impedane(float *samples, float *impedances, int cnt, int channels);
@@ -6,6 +6,7 @@
 
 #include <assert.h>
 #include <string.h>
+#include <errno.h>
 
 #include <system/system.h>
 
@@ -14,33 +15,143 @@
 #include "OpenBCI_32bit_Library_Definitions.h"
 
 /**
- * obci_text_cmds() - Send a multi char cmd and read a response.
+ * obci_write_all() - Write the whole buffer to the device.
  */
-int obci_text_cmds(struct obci_dev *dev, const char *cmd, char *buf, size_t len)
+static int obci_write_all(struct obci_dev *dev, const char *buf, size_t len)
 {
 	int ret;
-	int i = 0;
 
-	/* Writeout cmd bytes. */
-	while (*cmd) {
-		ret = s_fdputc(*cmd, dev->fd);
+	while (len) {
+		ret = s_write(dev->fd, (void *)buf, len);
 		if (ret < 0)
 			return ret;
-		cmd++;
+		buf += ret;
+		len -= ret;
 	}
 
-	/* Read back the response */
-	while (len && (i<3 || strncmp(&(buf[i-3]), "$$$", 3))) {
-		ret = s_read(dev->fd, &(buf[i]), 1);
+	return 0;
+}
+
+/**
+ * obci_rx_reply() - Take the next "$$$" terminated reply out of the receive buffer.
+ * @buf:     Buffer to copy the reply to or NULL, always NUL terminated.
+ * @len:     Size of @buf.
+ * @timeout: Longest wait for more data in milliseconds, negative to block.
+ *
+ * Return: Length of the reply, -ETIMEDOUT or other negative error.
+ */
+int obci_rx_reply(struct obci_dev *dev, char *buf, size_t len, int timeout)
+{
+	uint8_t *start, *pos, *end;
+	size_t cnt;
+	int ret;
+
+	for (;;) {
+		start = &dev->rx[dev->rx_pos];
+		end = &dev->rx[dev->rx_len];
+
+		for (pos = start; (pos = memchr(pos, '$', end - pos)); pos++)
+			if (end - pos >= 3 && pos[1] == '$' && pos[2] == '$')
+				break;
+
+		if (pos) {
+			cnt = pos + 3 - start;
+			if (buf && len) {
+				len = cnt < len ? cnt : len - 1;
+				memcpy(buf, start, len);
+				buf[len] = 0;
+				med_dbg(&dev->edev, "pkt ret = %s", buf);
+			}
+			dev->rx_pos += cnt;
+			return cnt;
+		}
+
+		/* Don't choke on overlong replies, keep only what may start the terminator. */
+		if (dev->rx_len - dev->rx_pos == sizeof(dev->rx))
+			dev->rx_pos = dev->rx_len - 2;
+
+		if (timeout >= 0) {
+			ret = s_poll(dev->fd, timeout);
+			if (ret < 0)
+				return ret;
+			if (!ret)
+				return -ETIMEDOUT;
+		}
+
+		ret = obci_rx_fill(dev);
 		if (ret < 0)
 			return ret;
-		i++;
-		len--;
 	}
+}
+
+/**
+ * obci_cmd_flush() - Send the queued commands and collect the replies.
+ *
+ * All the commands are written at once. The replies are only sent by
+ * the board when it's not streaming. A reply that doesn't come in
+ * time fails the flush with -ETIMEDOUT.
+ */
+int obci_cmd_flush(struct obci_dev *dev, struct obci_cmdbuf *cb)
+{
+	int i, ret;
+
+	if (!cb->len)
+		return 0;
+
+	/* The replies are read from the buffer, the buffered stream is stale. */
+	if (!dev->is_streaming)
+		obci_rx_reset(dev);
 
-	med_dbg(&dev->edev, "pkt ret = %s", buf);
+	ret = obci_write_all(dev, cb->buf, cb->len);
+	if (ret < 0)
+		goto error;
 
-	return i;
+	for (i = 0; !dev->is_streaming && i < cb->replies; ++i) {
+		ret = obci_rx_reply(dev, NULL, 0, OPENBCI_REPLY_TIMEOUT);
+		if (ret < 0)
+			goto error;
+	}
+
+	obci_cmd_init(cb);
+
+	return 0;
+
+error:
+	/* The shadow was updated when queuing, it's unknown what the board got. */
+	dev->chan_cfg_valid = false;
+	obci_cmd_init(cb);
+
+	return ret;
+}
+
+/**
+ * obci_text_query() - Send a multi char cmd and wait for the response.
+ * @timeout: Longest wait for the response data in milliseconds, negative to block.
+ */
+int obci_text_query(struct obci_dev *dev, const char *cmd, char *buf, size_t len, int timeout)
+{
+	int ret;
+
+	/* The response is read from the buffer, the buffered stream is stale. */
+	if (len)
+		obci_rx_reset(dev);
+
+	ret = obci_write_all(dev, cmd, strlen(cmd));
+	if (ret < 0)
+		return ret;
+
+	if (!len)
+		return 0;
+
+	return obci_rx_reply(dev, buf, len, timeout);
+}
+
+/**
+ * obci_text_cmds() - Send a multi char cmd and read a response.
+ */
+int obci_text_cmds(struct obci_dev *dev, const char *cmd, char *buf, size_t len)
+{
+	return obci_text_query(dev, cmd, buf, len, -1);
 }
 
 /**
@@ -54,53 +165,134 @@ int obci_text_cmd(struct obci_dev *dev, char cmd, char *buf, size_t len)
 }
 
 /**
- * obci_try_to_recover_pkt() - Try to align the packet stream back.
+ * obci_rx_find() - Find the next complete data packet in the receive buffer.
+ *
+ * The garbage before the packet is skipped. A packet is recognized by the
+ * magic byte and the end magic at the expected offset.
+ *
+ * Return: The packet, left in the buffer, or NULL if more data is needed.
  */
-int obci_try_to_recover_pkt(struct obci_dev *dev, struct openbci_data *data)
+static uint8_t *obci_rx_find(struct obci_dev *dev)
 {
-	int ret, cnt=0, byte;
+	uint8_t *start, *end = &dev->rx[dev->rx_len];
+	uint8_t *pos = &dev->rx[dev->rx_pos];
 
-	while (cnt < OPENBCI_PACKET_SIZE*10 && (data->magic != OPENBCI_DATA_MAGIC || (data->stop & 0xf0) != OPENBCI_DATA_END_MAGIC)) {
-		memmove(data, &data->seq, sizeof(*data)-1);
+	while (end - pos >= OPENBCI_PACKET_SIZE) {
+		start = pos;
+		pos = memchr(pos, OPENBCI_DATA_MAGIC, end - pos);
+		if (!pos) {
+			dev->rx_skipped += end - start;
+			pos = end;
+			break;
+		}
 
-		ret = s_read(dev->fd, &data->stop, 1);
-		if (ret < 0)
-			return ret;
-		
-		cnt++;
+		dev->rx_skipped += pos - start;
+
+		if (end - pos < OPENBCI_PACKET_SIZE)
+			break;
+
+		if ((pos[OPENBCI_PACKET_SIZE - 1] & 0xf0) != OPENBCI_DATA_END_MAGIC) {
+			dev->rx_skipped++;
+			pos++;
+			continue;
+		}
+
+		dev->rx_pos = pos - dev->rx;
+
+		return pos;
 	}
 
-	
-	assert(data->magic == OPENBCI_DATA_MAGIC);
-	assert((data->stop & 0xf0) == OPENBCI_DATA_END_MAGIC);
+	dev->rx_pos = pos - dev->rx;
 
-	med_info(&dev->edev, "Realigned after skipping %d bytes.", cnt);
-	return OPENBCI_PACKET_SIZE;
+	return NULL;
 }
 
 /**
- * obci_read_data_pkt() - Read and sanity-check a data packet.
+ * obci_rx_pkt() - Take the next complete data packet out of the receive buffer.
+ *
+ * Return: One if @data was filled, zero if more data is needed.
  */
-int obci_read_data_pkt(struct obci_dev *dev, struct openbci_data *data)
+int obci_rx_pkt(struct obci_dev *dev, struct openbci_data *data)
 {
-	int ret;
+	uint8_t *pos;
 
 	assert(sizeof(*data) == OPENBCI_PACKET_SIZE);
 
-	ret = s_read(dev->fd, data, sizeof(*data));
-	if (ret < 0)
-		return ret;
+	pos = obci_rx_find(dev);
+	if (!pos)
+		return 0;
 
-	assert(ret == OPENBCI_PACKET_SIZE);
+	memcpy(data, pos, sizeof(*data));
+	dev->rx_pos += OPENBCI_PACKET_SIZE;
 
-	if (data->magic != OPENBCI_DATA_MAGIC || (data->stop & 0xf0) != OPENBCI_DATA_END_MAGIC) {
-		med_info(&dev->edev, "Got packet with incorrect magic: (0x%02x 0x%02x) != (0x%02x 0x%02x)",
-				data->magic, (data->stop & 0xf0), OPENBCI_DATA_MAGIC, OPENBCI_DATA_END_MAGIC);
-		return obci_try_to_recover_pkt(dev, data);
+	if (dev->rx_skipped) {
+		med_info(&dev->edev, "Realigned after skipping %u bytes.", dev->rx_skipped);
+		dev->rx_skipped = 0;
 	}
 
-	assert(data->magic == OPENBCI_DATA_MAGIC);
-	assert((data->stop & 0xf0) == OPENBCI_DATA_END_MAGIC);
+	return 1;
+}
+
+/**
+ * obci_rx_pending() - Check for a complete data packet in the receive buffer.
+ */
+bool obci_rx_pending(struct obci_dev *dev)
+{
+	return obci_rx_find(dev);
+}
+
+/**
+ * obci_rx_fill() - Read whatever the device has sent into the receive buffer.
+ *
+ * Blocks until at least one byte is available.
+ *
+ * Return: Amount of bytes read or negative error.
+ */
+int obci_rx_fill(struct obci_dev *dev)
+{
+	size_t left = dev->rx_len - dev->rx_pos;
+	int ret;
+
+	/* Only an incomplete packet is left, move it to the front. */
+	memmove(dev->rx, &dev->rx[dev->rx_pos], left);
+	dev->rx_pos = 0;
+	dev->rx_len = left;
+
+	ret = s_read_some(dev->fd, &dev->rx[left], sizeof(dev->rx) - left);
+	if (ret < 0)
+		return ret;
+	if (!ret)
+		return -EPIPE;
+
+	dev->rx_len += ret;
 
 	return ret;
 }
+
+/**
+ * obci_rx_reset() - Drop the buffered data.
+ */
+void obci_rx_reset(struct obci_dev *dev)
+{
+	dev->rx_pos = 0;
+	dev->rx_len = 0;
+	dev->rx_skipped = 0;
+	dev->have_board = false;
+	dev->have_seq = false;
+}
+
+/**
+ * obci_read_data_pkt() - Read the next data packet, blocking.
+ */
+int obci_read_data_pkt(struct obci_dev *dev, struct openbci_data *data)
+{
+	int ret;
+
+	while (!obci_rx_pkt(dev, data)) {
+		ret = obci_rx_fill(dev);
+		if (ret < 0)
+			return ret;
+	}
+
+	return OPENBCI_PACKET_SIZE;
+}
@@ -19,6 +19,23 @@ struct openbci_data {
 #define OPENBCI_DATA_MAGIC 0xa0
 #define OPENBCI_DATA_END_MAGIC 0xc0
 
+/*
+ * The low nibble of the stop byte tells what the aux bytes hold.
+ */
+#define OPENBCI_STOP_ACCEL          0xc0 /* be16 accel[3] */
+#define OPENBCI_STOP_RAW_AUX        0xc1 /* be16 aux[3] */
+#define OPENBCI_STOP_USER_DEFINED   0xc2 /* be16 aux[3] */
+#define OPENBCI_STOP_TIME_SET_ACCEL 0xc3 /* be16 accel; be32 time */
+#define OPENBCI_STOP_TIME_ACCEL     0xc4 /* be16 accel; be32 time */
+#define OPENBCI_STOP_TIME_SET_RAW   0xc5 /* be16 aux; be32 time */
+#define OPENBCI_STOP_TIME_RAW       0xc6 /* be16 aux; be32 time */
+
+/* Amount of channels the aux bytes are decoded into. */
+#define OPENBCI_AUX_CHANS 3
+
+/* Accelerometer value of a single code in g. */
+#define OPENBCI_ACCEL_SCALE (0.002 / 16)
+
 /*
  * Some ectra helpers on top of the imported protocol definitions.
  */
@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+/*
+ * ring.c - Contiguous frame-interleaved sample storage.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <system/system.h>
+#include <med/ring.h>
+
+int med_ring_init(struct med_ring *ring, unsigned int frames, unsigned int stride)
+{
+	unsigned int size = 1;
+
+	while (size < frames)
+		size <<= 1;
+
+	memset(ring, 0, sizeof(*ring));
+
+	/* One more frame at the end is the spare one. */
+	ring->data = malloc(sizeof(*ring->data) * (size + 1) * stride);
+	if (!ring->data)
+		return -ENOMEM;
+
+	ring->info = malloc(sizeof(*ring->info) * size);
+	if (!ring->info) {
+		free(ring->data);
+		return -ENOMEM;
+	}
+
+	ring->spare = &ring->data[size * stride];
+	ring->size = size;
+	ring->stride = stride;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->received, 0);
+	atomic_init(&ring->dropped, 0);
+
+	return 0;
+}
+
+void med_ring_free(struct med_ring *ring)
+{
+	free(ring->data);
+	free(ring->info);
+	ring->data = NULL;
+	ring->info = NULL;
+	ring->size = 0;
+}
+
+float *med_ring_drop(struct med_ring *ring)
+{
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	unsigned long long cnt;
+
+	/*
+	 * If the consumer moves the tail at the same time, the
+	 * exchange fails, but then there is free space anyway.
+	 */
+	if (head - tail == ring->size
+	    && atomic_compare_exchange_strong_explicit(&ring->tail, &tail, tail + 1,
+			memory_order_acq_rel, memory_order_acquire)) {
+		cnt = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+		atomic_store_explicit(&ring->dropped, cnt + 1, memory_order_relaxed);
+	}
+
+	return med_ring_frame(ring, head);
+}
+
+/**
+ * med_ring_spans() - Split the frames between two indices into contiguous spans.
+ */
+static unsigned int med_ring_spans(const struct med_ring *ring,
+				   unsigned int tail, unsigned int head,
+				   float **first, unsigned int *nfirst,
+				   float **second, unsigned int *nsecond)
+{
+	unsigned int avail = head - tail;
+	unsigned int pos = tail & (ring->size - 1);
+	unsigned int len = ring->size - pos;
+
+	if (len > avail)
+		len = avail;
+
+	*first = avail ? med_ring_frame(ring, tail) : NULL;
+	*nfirst = len;
+	*second = avail > len ? ring->data : NULL;
+	*nsecond = avail - len;
+
+	return avail;
+}
+
+unsigned int med_ring_peek(struct med_ring *ring,
+			   float **first, unsigned int *nfirst,
+			   float **second, unsigned int *nsecond)
+{
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	return med_ring_spans(ring, tail, head, first, nfirst, second, nsecond);
+}
+
+unsigned int med_ring_consume(struct med_ring *ring, unsigned int count)
+{
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	unsigned int head, n;
+
+	do {
+		head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		n = head - tail;
+		if (n > count)
+			n = count;
+	} while (!atomic_compare_exchange_weak_explicit(&ring->tail, &tail, tail + n,
+			memory_order_acq_rel, memory_order_acquire));
+
+	return n;
+}
+
+/* Frames transposed at once, so the destination rows are written a cache line at a time. */
+#define MED_RING_BLOCK (MED_CACHELINE_SIZE / sizeof(float))
+
+/**
+ * med_ring_transpose() - Copy frames into per-channel rows.
+ * @dst:    The first destination row.
+ * @ld:     Distance between the destination rows.
+ * @src:    The first source frame.
+ * @stride: Amount of values in a frame.
+ * @count:  Amount of frames to copy.
+ */
+static void med_ring_transpose(float *dst, unsigned int ld, const float *src,
+			       unsigned int stride, unsigned int count)
+{
+	unsigned int i, j, k, n;
+
+	for (i = 0; i < count; i += MED_RING_BLOCK) {
+		n = count - i < MED_RING_BLOCK ? count - i : MED_RING_BLOCK;
+
+		for (j = 0; j < stride; ++j)
+			for (k = 0; k < n; ++k)
+				dst[j * ld + i + k] = src[(i + k) * stride + j];
+	}
+}
+
+/**
+ * med_ring_copy() - Copy the oldest frames out of the ring.
+ * @ld: Distance between the channel rows in @dst, or zero to copy the frames as they are.
+ */
+static unsigned int med_ring_copy(struct med_ring *ring, float *dst, unsigned int ld,
+				  struct med_eeg_sample_info *info, unsigned int count)
+{
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	unsigned int head, n1, n2;
+	float *p1, *p2;
+
+	/*
+	 * If the producer drops the oldest frames while they are being
+	 * copied, the data may be torn, so the copy is retried from the
+	 * new tail if it has moved.
+	 */
+	do {
+		head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		med_ring_spans(ring, tail, head, &p1, &n1, &p2, &n2);
+
+		/* At most two copies: up to the end of the storage and the wrapped rest. */
+		if (n1 > count)
+			n1 = count;
+		if (n2 > count - n1)
+			n2 = count - n1;
+
+		if (ld) {
+			med_ring_transpose(dst, ld, p1, ring->stride, n1);
+			med_ring_transpose(&dst[n1], ld, p2, ring->stride, n2);
+		} else {
+			if (n1)
+				memcpy(dst, p1, sizeof(*dst) * n1 * ring->stride);
+			if (n2)
+				memcpy(&dst[n1 * ring->stride], p2, sizeof(*dst) * n2 * ring->stride);
+		}
+
+		if (info && n1)
+			memcpy(info, &ring->info[tail & (ring->size - 1)], sizeof(*info) * n1);
+		if (info && n2)
+			memcpy(&info[n1], ring->info, sizeof(*info) * n2);
+	} while (!atomic_compare_exchange_strong_explicit(&ring->tail, &tail, tail + n1 + n2,
+			memory_order_acq_rel, memory_order_acquire));
+
+	return n1 + n2;
+}
+
+unsigned int med_ring_read(struct med_ring *ring, float *dst,
+			   struct med_eeg_sample_info *info, unsigned int count)
+{
+	return med_ring_copy(ring, dst, 0, info, count);
+}
+
+unsigned int med_ring_read_planar(struct med_ring *ring, float *dst, unsigned int ld,
+				  struct med_eeg_sample_info *info, unsigned int count)
+{
+	return med_ring_copy(ring, dst, ld, info, count);
+}
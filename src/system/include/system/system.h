@@ -116,7 +116,8 @@ ssize_t s_send(int sockfd, void *buf, size_t len, int flags);
  * This function is almost identical to the classic
  * recv with an exception of the error handling.
  * It also guarantees the receival of exactly len bytes
- * if no error happens.
+ * if no error happens, the peer closing the connection
+ * before that is an error (-EPIPE).
  *
  * Return: Data length on success or negative errno.
  */
@@ -134,6 +135,28 @@ ssize_t s_recv(int sockfd, void *buf, size_t len, int flags);
  */
 int s_flush(int sockfd);
 
+/**
+ * s_poll() - Wait for a file descriptor to become readable.
+ * @fd:      File descriptor.
+ * @timeout: Timeout in milliseconds, negative to wait forever.
+ *
+ * Return: 1 if readable, 0 on timeout or negative errno.
+ */
+int s_poll(int fd, int timeout);
+
+/**
+ * s_poll_event() - Wait for a file descriptor unless an event is signalled.
+ * @fd:      File descriptor.
+ * @event:   Event file descriptor that cuts the wait short.
+ * @timeout: Timeout in milliseconds, negative to wait forever.
+ *
+ * The event is not reset, see s_event_wait().
+ *
+ * Return: 1 if @fd is readable, 0 on timeout or if only @event was
+ * signalled, negative errno otherwise.
+ */
+int s_poll_event(int fd, int event, int timeout);
+
 /**
  * s_close() - Close a file descriptor.
  * @fd:     File descriptor.
@@ -159,6 +182,10 @@ int s_serial(int *fd, const char *name, int speed, int parity);
  * s_serial_flush() - Flush the serial port.
  * @fd:     File descriptor.
  *
+ * The input is read and discarded until the line stays idle for a
+ * few milliseconds, so the data the device is still sending is gone
+ * as well. Gives up after half a second if the device never stops.
+ *
  * Return: 0 on success and negative errno otherwise.
  */
 int s_serial_flush(int fd);
@@ -174,6 +201,18 @@ int s_serial_flush(int fd);
  */
 int s_read(int fd, void *buf, size_t count);
 
+/**
+ * s_read_some() - Read the data that is available.
+ * @fd:     File descriptor.
+ * @buf:    Pointer to data buffer.
+ * @count:  Size of the buffer.
+ *
+ * Unlike s_read(), the function returns as soon as some data
+ * was read, blocking only if none is available.
+ * Return: Amount of bytes read, zero at the end of file or negative errno.
+ */
+int s_read_some(int fd, void *buf, size_t count);
+
 /**
  * s_write() - Write to a file descriptor.
  * @fd:     File descriptor.
@@ -221,5 +260,122 @@ static inline int s_fdputc(int ch, int fd)
 
 }
 
+/* == Events == */
+
+/**
+ * s_event() - Create an event object.
+ * @fd:     Pointer to the file descriptor to be returned.
+ *
+ * The event is a pollable file descriptor that becomes readable
+ * once it was signalled (e.g. an eventfd).
+ *
+ * Return: 0 on success and negative errno otherwise.
+ */
+int s_event(int *fd);
+
+/**
+ * s_event_signal() - Signal the event.
+ * @fd:     Event file descriptor.
+ *
+ * Return: 0 on success and negative errno otherwise.
+ */
+int s_event_signal(int fd);
+
+/**
+ * s_event_wait() - Wait for the event and reset it.
+ * @fd:      Event file descriptor.
+ * @timeout: Timeout in milliseconds, negative to wait forever.
+ *
+ * Use zero @timeout to just reset the event.
+ *
+ * Return: 0 on success, -ETIMEDOUT or negative errno otherwise.
+ */
+int s_event_wait(int fd, int timeout);
+
+/* == Timers == */
+
+/**
+ * s_timer() - Create a periodic timer.
+ * @fd:     Pointer to the file descriptor to be returned.
+ * @period: Timer period in microseconds.
+ *
+ * The timer is a pollable file descriptor that becomes readable
+ * every time the period expires (e.g. a timerfd).
+ *
+ * Return: 0 on success and negative errno otherwise.
+ */
+int s_timer(int *fd, long period);
+
+/**
+ * s_timer_wait() - Wait for the timer to expire.
+ * @fd:     Timer file descriptor.
+ *
+ * Return: Amount of expired periods since the last call or negative errno.
+ */
+int s_timer_wait(int fd);
+
+/* == Pollers == */
+
+/**
+ * s_poller() - Create a poller for many file descriptors.
+ * @fd:     Pointer to the poller file descriptor to be returned.
+ *
+ * Return: 0 on success and negative errno otherwise.
+ */
+int s_poller(int *fd);
+
+/**
+ * s_poller_add() - Start watching a file descriptor for input.
+ * @pfd:     Poller file descriptor.
+ * @fd:      File descriptor to watch.
+ * @data:    Pointer to return from s_poller_wait() for this @fd.
+ * @oneshot: Stop watching @fd after it was reported once.
+ *
+ * A oneshot descriptor is reported to only one waiter and has to
+ * be re-armed with s_poller_rearm() when it was serviced.
+ *
+ * Return: 0 on success and negative errno otherwise.
+ */
+int s_poller_add(int pfd, int fd, void *data, int oneshot);
+
+/**
+ * s_poller_rearm() - Watch a oneshot file descriptor again.
+ *
+ * Return: 0 on success and negative errno otherwise.
+ */
+int s_poller_rearm(int pfd, int fd, void *data);
+
+/**
+ * s_poller_del() - Stop watching a file descriptor.
+ *
+ * Return: 0 on success and negative errno otherwise.
+ */
+int s_poller_del(int pfd, int fd);
+
+/**
+ * s_poller_wait() - Wait for the watched descriptors to become readable.
+ * @pfd:     Poller file descriptor.
+ * @data:    Array to return the data pointers of the ready descriptors to.
+ * @count:   Size of the @data array.
+ * @timeout: Timeout in milliseconds, negative to wait forever.
+ *
+ * Return: Amount of ready descriptors, 0 on timeout or negative errno.
+ */
+int s_poller_wait(int pfd, void **data, int count, int timeout);
+
+/* == Misc == */
+
+/**
+ * s_time_ns() - Read the monotonic clock.
+ *
+ * Return: Time in nanoseconds since an arbitrary point.
+ */
+int64_t s_time_ns(void);
+
+/**
+ * s_cpu_count() - Get the amount of online CPUs.
+ */
+int s_cpu_count(void);
+
 #endif /* SYSTEM_H */
 
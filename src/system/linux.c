@@ -17,6 +17,11 @@
 
 #include <fcntl.h>
 #include <termios.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <time.h>
 
 #include <system/system.h>
 
@@ -75,19 +80,22 @@ ssize_t s_send(int sockfd, void *buf, size_t len, int flags)
 
 ssize_t s_recv(int sockfd, void *buf, size_t len, int flags)
 {
-	ssize_t ret = 0;
 	size_t rcv_len = 0;
-	int attempt = 100;
+	ssize_t ret;
 
-	while (rcv_len < len && attempt--) {
-		ret = recv(sockfd, buf, len - rcv_len, flags);
-		if (ret > 0)
-			rcv_len += ret;
+	while (rcv_len < len) {
+		ret = recv(sockfd, &((uint8_t *)buf)[rcv_len], len - rcv_len, flags);
+		if (ret < 0 && errno == EINTR)
+			continue;
 		if (ret < 0)
 			return -errno;
+		if (!ret)
+			return -EPIPE;
+
+		rcv_len += ret;
 	}
 
-	return (ret < 0 || !attempt) ? -errno : ret;
+	return rcv_len;
 }
 
 int s_flush(int sockfd)
@@ -113,6 +121,42 @@ int s_flush(int sockfd)
 	return ret;
 }
 
+int s_poll(int fd, int timeout)
+{
+	struct pollfd pfd = {
+		.fd = fd,
+		.events = POLLIN,
+	};
+	int ret;
+
+	do {
+		ret = poll(&pfd, 1, timeout);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -errno;
+
+	return ret > 0;
+}
+
+int s_poll_event(int fd, int event, int timeout)
+{
+	struct pollfd pfd[2] = {
+		{ .fd = fd, .events = POLLIN },
+		{ .fd = event, .events = POLLIN },
+	};
+	int ret;
+
+	do {
+		ret = poll(pfd, 2, timeout);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -errno;
+
+	return !!(pfd[0].revents & (POLLIN | POLLHUP | POLLERR));
+}
+
 int s_close(int fd)
 {
 	return close(fd) ? -errno : 0;
@@ -153,14 +197,31 @@ error:
 	return ret;
 }
 
+/* The line is considered quiet when nothing arrives for this long. */
+#define S_SERIAL_IDLE_MS 10
+/* Upper bound of the drain, a device may never stop sending. */
+#define S_SERIAL_DRAIN_MS 500
+
 int s_serial_flush(int fd)
 {
+	int64_t end = s_time_ns() + S_SERIAL_DRAIN_MS * 1000000LL;
+	uint8_t buf[256];
 	int ret;
 
-	/*
-	 * HACK: Wait for the data to arrive into the kernel buffer
-	 */
-	usleep(500000);
+	/* Drain the data still on the way, until the line goes idle. */
+	while (s_time_ns() < end) {
+		ret = s_poll(fd, S_SERIAL_IDLE_MS);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			break;
+
+		ret = s_read_some(fd, buf, sizeof(buf));
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			break;
+	}
 
 	ret = tcflush(fd,TCIFLUSH);
 	if (ret < 0)
@@ -184,6 +245,19 @@ int s_read(int fd, void *buf, size_t count)
 	return ret;
 }
 
+int s_read_some(int fd, void *buf, size_t count)
+{
+	int ret;
+
+	do {
+		ret = read(fd, buf, count);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -errno;
+
+	return ret;
+}
 
 int s_write(int fd, void *buf, size_t count)
 {
@@ -195,3 +269,153 @@ int s_write(int fd, void *buf, size_t count)
 
 	return ret;
 }
+
+/* Events */
+
+int s_event(int *fd)
+{
+	*fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (*fd < 0)
+		return -errno;
+
+	return 0;
+}
+
+int s_event_signal(int fd)
+{
+	uint64_t val = 1;
+
+	if (write(fd, &val, sizeof(val)) < 0)
+		return -errno;
+
+	return 0;
+}
+
+int s_event_wait(int fd, int timeout)
+{
+	uint64_t val;
+	int ret;
+
+	if (timeout) {
+		ret = s_poll(fd, timeout);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			return -ETIMEDOUT;
+	}
+
+	/* The event is non-blocking, so this only resets it. */
+	if (read(fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		return -errno;
+
+	return 0;
+}
+
+/* Timers */
+
+int s_timer(int *fd, long period)
+{
+	struct itimerspec spec = {
+		.it_interval = {
+			.tv_sec = period / 1000000,
+			.tv_nsec = (period % 1000000) * 1000,
+		},
+	};
+
+	spec.it_value = spec.it_interval;
+
+	*fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (*fd < 0)
+		return -errno;
+
+	if (timerfd_settime(*fd, 0, &spec, NULL) < 0) {
+		close(*fd);
+		return -errno;
+	}
+
+	return 0;
+}
+
+int s_timer_wait(int fd)
+{
+	uint64_t val;
+	int ret;
+
+	ret = s_read(fd, &val, sizeof(val));
+	if (ret < 0)
+		return ret;
+
+	return val;
+}
+
+/* Pollers */
+
+int s_poller(int *fd)
+{
+	*fd = epoll_create1(EPOLL_CLOEXEC);
+	if (*fd < 0)
+		return -errno;
+
+	return 0;
+}
+
+int s_poller_add(int pfd, int fd, void *data, int oneshot)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN | (oneshot ? EPOLLONESHOT : 0),
+		.data.ptr = data,
+	};
+
+	return epoll_ctl(pfd, EPOLL_CTL_ADD, fd, &ev) ? -errno : 0;
+}
+
+int s_poller_rearm(int pfd, int fd, void *data)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLONESHOT,
+		.data.ptr = data,
+	};
+
+	return epoll_ctl(pfd, EPOLL_CTL_MOD, fd, &ev) ? -errno : 0;
+}
+
+int s_poller_del(int pfd, int fd)
+{
+	return epoll_ctl(pfd, EPOLL_CTL_DEL, fd, NULL) ? -errno : 0;
+}
+
+int s_poller_wait(int pfd, void **data, int count, int timeout)
+{
+	struct epoll_event ev[16];
+	int ret, i;
+
+	if (count > 16)
+		count = 16;
+
+	ret = epoll_wait(pfd, ev, count, timeout);
+	if (ret < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	for (i = 0; i < ret; ++i)
+		data[i] = ev[i].data.ptr;
+
+	return ret;
+}
+
+/* Misc */
+
+int64_t s_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int s_cpu_count(void)
+{
+	long ret = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return ret > 0 ? ret : 1;
+}
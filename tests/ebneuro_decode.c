@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+/*
+ * ebneuro_decode.c - Check the vectorized EBNeuro decode.
+ *
+ * eb_decode() and eb_decode_codes() shall give exactly the same frames
+ * as med_eeg_put_code() called for each channel, which is how all the
+ * other paths decode a channel. The input is random, placed at every
+ * offset within a cache line and cut to every length up to a record,
+ * so the SIMD blocks and the tails are all covered.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ebneuro.h"
+
+#define CHECK_ROUNDS 50
+#define CHECK_CHANS (EB_BEPLUSLTM_EEG_CHAN + EB_BEPLUSLTM_DC_CHAN)
+#define CHECK_ALIGN 64
+
+static float rand_float(float min, float max)
+{
+	return min + (max - min) * ((float)rand() / RAND_MAX);
+}
+
+/**
+ * check() - Compare a single decode with the generic path.
+ * @src: Input of @cnt values.
+ *
+ * Return: Zero if the frames are bit-exact, one otherwise.
+ */
+static int check(struct med_eeg *dev, const uint8_t *src, int cnt,
+		 const float *gain, const float *offset)
+{
+	float ref[CHECK_CHANS], out[CHECK_CHANS];
+	__le16 code;
+	int i;
+
+	for (i = 0; i < cnt; ++i) {
+		memcpy(&code, &src[i * sizeof(code)], sizeof(code));
+		med_eeg_put_code(dev, ref, i, (int16_t)le16_to_cpu(code));
+	}
+
+	if (dev->raw)
+		eb_decode_codes(src, cnt, out);
+	else
+		eb_decode(src, cnt, gain, offset, out);
+
+	for (i = 0; i < cnt; ++i) {
+		if (memcmp(&ref[i], &out[i], sizeof(ref[i]))) {
+			fprintf(stderr, "%s: channel %d of %d differs: %a != %a\n",
+				dev->raw ? "raw" : "scaled", i, cnt, out[i], ref[i]);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	static uint8_t buf[CHECK_ALIGN + CHECK_CHANS * sizeof(__le16)];
+	struct med_eeg_scale scales[CHECK_CHANS];
+	float gain[CHECK_CHANS], offset[CHECK_CHANS];
+	struct med_eeg dev = {
+		.type = "check",
+		.scales = scales,
+	};
+	int round, align, cnt, i, fail = 0;
+	size_t j;
+
+	srand(1);
+
+	for (round = 0; round < CHECK_ROUNDS && !fail; ++round) {
+		for (j = 0; j < sizeof(buf); ++j)
+			buf[j] = rand();
+
+		/* Both the EEG and the DC scales, and some arbitrary ones. */
+		for (i = 0; i < CHECK_CHANS; ++i) {
+			scales[i].gain = round % 2 ? rand_float(-1e3f, 1e3f) : 0.125e-6f;
+			scales[i].offset = round % 3 ? rand_float(-1e3f, 1e3f) : 0;
+			gain[i] = scales[i].gain;
+			offset[i] = scales[i].offset;
+		}
+
+		for (align = 0; align < CHECK_ALIGN && !fail; ++align) {
+			for (cnt = 1; cnt <= CHECK_CHANS && !fail; ++cnt) {
+				dev.raw = false;
+				fail = check(&dev, &buf[align], cnt, gain, offset);
+				if (fail)
+					break;
+
+				dev.raw = true;
+				fail = check(&dev, &buf[align], cnt, gain, offset);
+			}
+		}
+	}
+
+	printf("ebneuro decode: %s\n", fail ? "FAILED" : "OK");
+
+	return fail;
+}
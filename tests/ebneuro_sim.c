@@ -0,0 +1,212 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+/*
+ * ebneuro_sim.c - Run the ebneuro driver against the device simulator.
+ *
+ * Starts ebsim unpaced, leaving out every tenth data packet, and reads
+ * the samples. The simulator sends a known signal, so the codes of every
+ * sample are compared with it by the sequence number. The samples missing in
+ * the sequence shall be the left out packets, and all of them shall be
+ * accounted as lost once the stream is read to the end.
+ *
+ * Usage: ebneuro_sim <path to ebsim>
+ */
+
+#include <unistd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include <med/eeg.h>
+
+#include "packets.h"
+
+/* Must match the simulator defaults and the options it's started with. */
+#define SIM_WAVE_LEN 256
+#define SIM_DROP 10
+#define SIM_RECORDS (512 / 64)
+
+#define CHECK_SAMPLES 8192
+#define CHECK_CHANS (EB_BEPLUSLTM_EEG_CHAN + EB_BEPLUSLTM_DC_CHAN)
+
+static int16_t wave[SIM_WAVE_LEN];
+static struct med_eeg_scale scales[CHECK_CHANS];
+
+static pid_t start_sim(const char *path)
+{
+	char drop[16];
+	pid_t pid;
+
+	snprintf(drop, sizeof(drop), "%d", SIM_DROP);
+
+	pid = fork();
+	if (!pid) {
+		execl(path, "ebsim", "-x", "0", "-g", drop, (char *)NULL);
+		perror("exec");
+		_exit(127);
+	}
+
+	return pid;
+}
+
+static int stop_sim(pid_t pid)
+{
+	int status;
+
+	kill(pid, SIGINT);
+	if (waitpid(pid, &status, 0) < 0)
+		return -errno;
+
+	return WIFEXITED(status) && !WEXITSTATUS(status) ? 0 : -ECHILD;
+}
+
+/**
+ * connect_dev() - Open the device, the simulator may still be starting.
+ */
+static int connect_dev(struct med_eeg **dev)
+{
+	struct med_kv kv[] = {
+		{ "address", "127.0.0.1" },
+		{ NULL, NULL },
+	};
+	struct timespec ts = { .tv_nsec = 20000000 };
+	int i, ret = -ECONNREFUSED;
+
+	for (i = 0; i < 100 && ret; ++i) {
+		ret = med_eeg_create(dev, "ebneuro", kv);
+		if (ret)
+			nanosleep(&ts, NULL);
+	}
+
+	return ret;
+}
+
+/**
+ * check_sample() - Compare a sample with the signal the simulator sent.
+ * @seq: Expected sequence number, updated to the one after @info.
+ *
+ * Return: Amount of samples missing before this one, or negative on mismatch.
+ */
+static long long check_sample(const float *samples, const struct med_eeg_sample_info *info,
+			      unsigned long long *seq)
+{
+	unsigned long long s;
+	long code;
+	int j;
+
+	if (info->seq < *seq) {
+		fprintf(stderr, "sample %llu after %llu\n", info->seq, *seq - 1);
+		return -1;
+	}
+
+	/* Only whole packets are left out, and only the dropped ones. */
+	for (s = *seq; s < info->seq; s += SIM_RECORDS) {
+		if (s % SIM_RECORDS || s / SIM_RECORDS % SIM_DROP != SIM_DROP - 1) {
+			fprintf(stderr, "sample %llu missing\n", s);
+			return -1;
+		}
+	}
+
+	for (j = 0; j < CHECK_CHANS; ++j) {
+		code = lrintf((samples[j] - scales[j].offset) / scales[j].gain);
+		if (code != wave[(info->seq + j * 4) % SIM_WAVE_LEN]) {
+			fprintf(stderr, "sample %llu channel %d: %ld != %d\n", info->seq, j,
+				code, wave[(info->seq + j * 4) % SIM_WAVE_LEN]);
+			return -1;
+		}
+	}
+
+	s = *seq;
+	*seq = info->seq + 1;
+
+	return info->seq - s;
+}
+
+int main(int argc, char *argv[])
+{
+	struct med_eeg_sample_info info;
+	struct med_eeg_stats stats;
+	float samples[CHECK_CHANS];
+	unsigned long long seq = 0, missing = 0, read = 0;
+	struct med_eeg *dev;
+	long long gap;
+	int i, ret, fail = 1;
+	pid_t pid;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <path to ebsim>\n", argv[0]);
+		return 1;
+	}
+
+	for (i = 0; i < SIM_WAVE_LEN; ++i)
+		wave[i] = 1000 * sin(2 * M_PI * i / SIM_WAVE_LEN);
+
+	pid = start_sim(argv[1]);
+	if (pid < 0)
+		return 1;
+
+	ret = connect_dev(&dev);
+	if (ret) {
+		fprintf(stderr, "Failed to connect: %d\n", ret);
+		stop_sim(pid);
+		goto out;
+	}
+
+	ret = med_eeg_get_scales(dev, scales);
+	if (ret != CHECK_CHANS) {
+		fprintf(stderr, "Unexpected channels: %d\n", ret);
+		stop_sim(pid);
+		goto destroy;
+	}
+
+	ret = med_eeg_set_mode(dev, MED_EEG_SAMPLING);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to start sampling: %d\n", ret);
+		stop_sim(pid);
+		goto destroy;
+	}
+
+	/* Stop the simulator part way, then read what it sent to the end. */
+	while ((ret = med_eeg_sample_ts(dev, samples, &info, 1)) > 0) {
+		gap = check_sample(samples, &info, &seq);
+		if (gap < 0)
+			break;
+
+		missing += gap;
+		if (++read == CHECK_SAMPLES && stop_sim(pid))
+			break;
+	}
+
+	if (read < CHECK_SAMPLES) {
+		fprintf(stderr, "Stream ended after %llu samples: %d\n", read, ret);
+		stop_sim(pid);
+		goto destroy;
+	}
+
+	if (ret != -EPIPE) {
+		fprintf(stderr, "Stream failed: %d\n", ret);
+		goto destroy;
+	}
+
+	med_eeg_get_stats(dev, &stats);
+
+	if (stats.received != read || stats.lost != missing || stats.dropped) {
+		fprintf(stderr, "stats: received %llu of %llu, lost %llu of %llu, dropped %llu\n",
+			stats.received, read, stats.lost, missing, stats.dropped);
+		goto destroy;
+	}
+
+	fail = 0;
+
+destroy:
+	med_eeg_destroy(dev);
+out:
+	printf("ebneuro sim: %s\n", fail ? "FAILED" : "OK");
+
+	return fail;
+}
@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+/*
+ * openbci_stream.c - Check that a restarted OpenBCI stream starts fresh.
+ *
+ * A board is emulated on a pseudo terminal. It answers the commands the
+ * driver sends and streams a burst of packets on every stream start, the
+ * packets carry the number of the stream in the first channel. The
+ * device is switched between the idle and the sampling mode a few times
+ * and the first sample of each stream shall come from that stream, not
+ * from the packets left over from the previous one.
+ */
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <med/eeg.h>
+
+#define CHECK_STREAMS 3
+
+/* Packets sent on every stream start, fewer than the driver buffers. */
+#define BOARD_BURST 40
+#define BOARD_PACKET_LEN 33
+
+struct board {
+	int fd;
+	int stream;
+};
+
+static int board_write(struct board *b, const void *buf, size_t len)
+{
+	const char *pos = buf;
+	ssize_t ret;
+
+	while (len) {
+		ret = write(b->fd, pos, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+
+		pos += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static int board_reply(struct board *b, const char *reply)
+{
+	return board_write(b, reply, strlen(reply));
+}
+
+/**
+ * board_burst() - Send the packets of a new stream at once.
+ *
+ * The first channel holds the stream number times 1000 plus the
+ * packet index, the other channels are zero.
+ */
+static int board_burst(struct board *b)
+{
+	uint8_t buf[BOARD_BURST * BOARD_PACKET_LEN] = { 0 };
+	uint8_t *pkt;
+	int i, code;
+
+	b->stream++;
+
+	for (i = 0; i < BOARD_BURST; ++i) {
+		pkt = &buf[i * BOARD_PACKET_LEN];
+		code = b->stream * 1000 + i;
+
+		pkt[0] = 0xa0;
+		pkt[1] = i;
+		pkt[2] = code >> 16;
+		pkt[3] = code >> 8;
+		pkt[4] = code;
+		pkt[BOARD_PACKET_LEN - 1] = 0xc0;
+	}
+
+	return board_write(b, buf, sizeof(buf));
+}
+
+/**
+ * board_skip() - Read the rest of a multi char command.
+ */
+static int board_skip(struct board *b, char latch)
+{
+	char c;
+
+	do {
+		if (read(b->fd, &c, 1) != 1)
+			return -EIO;
+	} while (c != latch);
+
+	return 0;
+}
+
+static void *board_run(void *arg)
+{
+	struct board *b = arg;
+	int ret = 0;
+	char c;
+
+	/* Ends with EIO once the driver closes the port, or when cancelled. */
+	while (!ret && read(b->fd, &c, 1) == 1) {
+		switch (c) {
+		case 'v':
+			ret = board_reply(b, "OpenBCI V3 8 channel\nFirmware: v3.1.2\n$$$");
+			break;
+		case 'V':
+			ret = board_reply(b, "v3.1.2$$$");
+			break;
+		case 'b':
+			ret = board_burst(b);
+			break;
+		case 'x':
+			ret = board_skip(b, 'X');
+			if (!ret)
+				ret = board_reply(b, "Success: Channel set$$$");
+			break;
+		case 'z':
+			ret = board_skip(b, 'Z');
+			if (!ret)
+				ret = board_reply(b, "Success: Lead off set$$$");
+			break;
+		case 'd':
+			ret = board_reply(b, "Updating channel settings to default$$$");
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+int main(void)
+{
+	struct timespec settle = { .tv_nsec = 50000000 };
+	char port[64];
+	struct med_kv kv[] = {
+		{ "port", port },
+		{ "channels", "8" },
+		{ "raw", "1" },
+		{ NULL, NULL },
+	};
+	struct board board = { 0 };
+	struct med_eeg *dev;
+	pthread_t thread;
+	int32_t codes[8];
+	int i, ret, fail = 1;
+
+	board.fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (board.fd < 0 || grantpt(board.fd) || unlockpt(board.fd)
+	    || ptsname_r(board.fd, port, sizeof(port))) {
+		perror("pty");
+		return 1;
+	}
+
+	if (pthread_create(&thread, NULL, board_run, &board)) {
+		close(board.fd);
+		return 1;
+	}
+
+	ret = med_eeg_create(&dev, "openbci", kv);
+	if (ret) {
+		fprintf(stderr, "Failed to create the device: %d\n", ret);
+		goto out;
+	}
+
+	for (i = 1; i <= CHECK_STREAMS; ++i) {
+		ret = med_eeg_set_mode(dev, MED_EEG_SAMPLING);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to start stream %d: %d\n", i, ret);
+			goto destroy;
+		}
+
+		/* Let the whole burst arrive, only one sample is taken out of it. */
+		nanosleep(&settle, NULL);
+
+		ret = med_eeg_sample_raw(dev, codes, 1);
+		if (ret != 1) {
+			fprintf(stderr, "Failed to sample stream %d: %d\n", i, ret);
+			goto destroy;
+		}
+
+		if (codes[0] != i * 1000) {
+			fprintf(stderr, "Stream %d started with packet %d of stream %d\n",
+				i, codes[0] % 1000, codes[0] / 1000);
+			goto destroy;
+		}
+
+		ret = med_eeg_set_mode(dev, MED_EEG_IDLE);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to stop stream %d: %d\n", i, ret);
+			goto destroy;
+		}
+	}
+
+	fail = 0;
+
+destroy:
+	med_eeg_destroy(dev);
+out:
+	pthread_cancel(thread);
+	pthread_join(thread, NULL);
+	close(board.fd);
+
+	printf("openbci stream: %s\n", fail ? "FAILED" : "OK");
+
+	return fail;
+}